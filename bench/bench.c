@@ -0,0 +1,393 @@
+/**
+ * @file bench.c
+ * @brief end-to-end benchmark for the comment tool
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+
+/* USAGE
+ * bench/bench [--quick] [-d directory] path/to/comment > results.json
+ *
+ * Every scenario generates a synthetic tree, and runs comment -r over it
+ * three times: cold (file contents dropped from the page cache), warm (all
+ * files just read) and rerun (a second run over the tree the warm run just
+ * stamped, where every date is already current). Each tree is generated
+ * from scratch before the cold and the warm run, so they do the same work.
+ *
+ * Bytes written are taken from /proc/self/io of this process, since the
+ * counters of a child are added to its parent when it is reaped. wchar is
+ * everything passed to write(), copy_file_range() and friends, write_bytes
+ * is what actually had to go to storage.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define FILES_PER_DIRECTORY 1000
+#define MEGABYTE (1024.0 * 1024.0)
+
+enum bench_kind {
+	KIND_C_DATED,
+	KIND_C_PLAIN,
+	KIND_CPP_DATED,
+	KIND_SH_SHEBANG,
+	KIND_SH_PLAIN,
+	KIND_MAKEFILE,
+	KIND_TEX
+};
+
+struct bench_scenario {
+	const char *name;
+	enum bench_kind kind;
+	int count;
+	size_t size;
+};
+
+typedef struct bench_scenario SCENARIO;
+
+static const SCENARIO SCENARIOS[] = {
+	{ "c-dated-1k",       KIND_C_DATED,    1000,   1024 },
+	{ "c-dated-1k-x20k",  KIND_C_DATED,    20000,  1024 },
+	{ "c-plain-1k-x20k",  KIND_C_PLAIN,    20000,  1024 },
+	{ "cpp-dated-16k",    KIND_CPP_DATED,  5000,   16 * 1024 },
+	{ "sh-shebang-1k",    KIND_SH_SHEBANG, 20000,  1024 },
+	{ "sh-plain-1k",      KIND_SH_PLAIN,   20000,  1024 },
+	{ "makefile-4k",      KIND_MAKEFILE,   5000,   4 * 1024 },
+	{ "tex-8k",           KIND_TEX,        5000,   8 * 1024 },
+	{ "c-dated-1m",       KIND_C_DATED,    500,    1024 * 1024 },
+	{ "c-plain-50m",      KIND_C_PLAIN,    10,     50 * 1024 * 1024 },
+	{ "c-dated-1k-x200k", KIND_C_DATED,    200000, 1024 }
+};
+
+#define SCENARIO_COUNT (sizeof(SCENARIOS) / sizeof(SCENARIOS[0]))
+
+struct bench_io {
+	unsigned long long wchar;
+	unsigned long long writeBytes;
+};
+
+typedef struct bench_io IO;
+
+/* The dates in generated headers never match the mtime, which is set to this */
+static const time_t GENERATED_MTIME = 1577880000;
+
+static const char *extensionOf(enum bench_kind kind) {
+	switch (kind) {
+		case KIND_C_DATED:
+		case KIND_C_PLAIN:
+			return ".c";
+		case KIND_CPP_DATED:
+			return ".cpp";
+		case KIND_SH_SHEBANG:
+		case KIND_SH_PLAIN:
+			return ".sh";
+		case KIND_MAKEFILE:
+			return ".mk";
+		case KIND_TEX:
+			return ".tex";
+	}
+	return "";
+}
+
+static int writeHeader(FILE *f, enum bench_kind kind, const char *localname) {
+	switch (kind) {
+		case KIND_C_DATED:
+		case KIND_CPP_DATED:
+			return fprintf(f, "/" "**\n * @file %s\n * @author Bench\n * @date 2001-01-01\n */\n", localname);
+		case KIND_C_PLAIN:
+			return fprintf(f, "#include <stdio.h>\n");
+		case KIND_SH_SHEBANG:
+			return fprintf(f, "#!/bin/sh\n# Author: Bench\n# Date: 2001-01-01\n\n");
+		case KIND_SH_PLAIN:
+			return fprintf(f, "set -e\n");
+		case KIND_MAKEFILE:
+			return fprintf(f, "# Makefile\n# Author: Bench\n# Date: 2001-01-01\n\n");
+		case KIND_TEX:
+			return fprintf(f, "%% Date: 2001-01-01\n\\documentclass{article}\n");
+	}
+	return 0;
+}
+
+static int writeFillerLine(FILE *f, enum bench_kind kind, int line) {
+	switch (kind) {
+		case KIND_C_DATED:
+		case KIND_C_PLAIN:
+		case KIND_CPP_DATED:
+			return fprintf(f, "static int f%d(int x) { return x * %d; } /* filler */\n", line, line);
+		case KIND_SH_SHEBANG:
+		case KIND_SH_PLAIN:
+			return fprintf(f, "echo \"line %d\" # filler\n", line);
+		case KIND_MAKEFILE:
+			return fprintf(f, "target%d: source%d.c\n\tgcc -c source%d.c\n", line, line, line);
+		case KIND_TEX:
+			return fprintf(f, "Paragraph %d of filler text for the benchmark.\n\n", line);
+	}
+	return 0;
+}
+
+static int generateFile(const char *path, const char *localname, enum bench_kind kind, size_t size) {
+	FILE *f = fopen(path, "w");
+	if (!f) return -1;
+
+	size_t written = writeHeader(f, kind, localname);
+	for (int line = 0; written < size; ++line) {
+		int count = writeFillerLine(f, kind, line);
+		if (count <= 0) break;
+		written += count;
+	}
+
+	if (fclose(f) != 0) return -1;
+
+	struct timespec times[2];
+	times[0].tv_sec = GENERATED_MTIME;
+	times[0].tv_nsec = 0;
+	times[1] = times[0];
+	return utimensat(AT_FDCWD, path, times, 0);
+}
+
+static int removeEntry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+	return remove(path);
+}
+
+static void removeTree(const char *root) {
+	nftw(root, removeEntry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+/* Generates count files in subdirectories of FILES_PER_DIRECTORY files,
+ * and returns the total number of bytes */
+static long long generateTree(const char *root, const SCENARIO *scenario, int count, size_t size) {
+	removeTree(root);
+	if (mkdir(root, 0755) != 0) return -1;
+
+	char path[4096];
+	char localname[64];
+	long long total = 0;
+
+	for (int i = 0; i < count; ++i) {
+		if (i % FILES_PER_DIRECTORY == 0) {
+			snprintf(path, sizeof(path), "%s/d%d", root, i / FILES_PER_DIRECTORY);
+			if (mkdir(path, 0755) != 0) return -1;
+		}
+
+		snprintf(localname, sizeof(localname), "f%d%s", i, extensionOf(scenario->kind));
+		snprintf(path, sizeof(path), "%s/d%d/%s", root, i / FILES_PER_DIRECTORY, localname);
+		if (generateFile(path, localname, scenario->kind, size) != 0) return -1;
+
+		struct stat st;
+		if (stat(path, &st) == 0) total += st.st_size;
+	}
+
+	return total;
+}
+
+/* Either drops every file from the page cache, or reads every file into it */
+static int dropping;
+
+static int cacheFile(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+	if (flag != FTW_F) return 0;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return 0;
+
+	if (dropping) {
+		fdatasync(fd);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	}
+	else {
+		char buffer[65536];
+		while (read(fd, buffer, sizeof(buffer)) > 0) {
+		}
+	}
+
+	close(fd);
+	return 0;
+}
+
+static void prepareCache(const char *root, int cold) {
+	sync();
+	dropping = cold;
+	nftw(root, cacheFile, 64, FTW_PHYS);
+}
+
+static void readIo(IO *io) {
+	memset(io, 0, sizeof(IO));
+
+	FILE *f = fopen("/proc/self/io", "r");
+	if (!f) return;
+
+	char key[64];
+	unsigned long long value;
+	while (fscanf(f, "%63[^:]: %llu\n", key, &value) == 2) {
+		if (strcmp("wchar", key) == 0) io->wchar = value;
+		else if (strcmp("write_bytes", key) == 0) io->writeBytes = value;
+	}
+
+	fclose(f);
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Runs comment -r over the tree, with HOME pointing at the tree so that no
+ * personal configuration changes what is measured */
+static int runComment(const char *binary, const char *root, double *seconds, IO *written) {
+	IO before;
+	IO after;
+	readIo(&before);
+	double start = now();
+
+	pid_t pid = fork();
+	if (pid < 0) return -1;
+	if (pid == 0) {
+		if (chdir(root) != 0) _exit(127);
+		setenv("HOME", ".", 1);
+		int devnull = open("/dev/null", O_WRONLY);
+		if (devnull >= 0) dup2(devnull, STDOUT_FILENO);
+		execl(binary, binary, "-r", ".", (char *)NULL);
+		_exit(127);
+	}
+
+	int status;
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR) return -1;
+	}
+
+	*seconds = now() - start;
+	readIo(&after);
+	written->wchar = after.wchar - before.wchar;
+	written->writeBytes = after.writeBytes - before.writeBytes;
+
+	return (WIFEXITED(status) && WEXITSTATUS(status) != 127) ? 0 : -1;
+}
+
+static void printRun(const char *mode, int count, long long bytes, double seconds, const IO *written, int last) {
+	fprintf(stdout,
+		"        { \"mode\": \"%s\", \"seconds\": %.6f, \"files_per_sec\": %.1f, \"mb_per_sec\": %.2f, "
+		"\"bytes_written\": %llu, \"storage_bytes_written\": %llu, \"written_per_input_byte\": %.4f }%s\n",
+		mode, seconds,
+		(seconds > 0 ? count / seconds : 0.0),
+		(seconds > 0 ? bytes / MEGABYTE / seconds : 0.0),
+		written->wchar, written->writeBytes,
+		(bytes > 0 ? (double)written->wchar / bytes : 0.0),
+		(last ? "" : ","));
+}
+
+static int runScenario(const char *binary, const char *root, const SCENARIO *scenario, int quick, int last) {
+	int count = scenario->count;
+	size_t size = scenario->size;
+	if (quick) {
+		count = (count / 100 > 10) ? count / 100 : 10;
+		if (size > 1024 * 1024) size = 1024 * 1024;
+	}
+
+	long long bytes = 0;
+	double seconds[3];
+	IO written[3];
+
+	for (int cold = 1; cold >= 0; --cold) {
+		bytes = generateTree(root, scenario, count, size);
+		if (bytes < 0) {
+			fprintf(stderr, "Could not generate '%s' in '%s': %s\n", scenario->name, root, strerror(errno));
+			return 2;
+		}
+
+		prepareCache(root, cold);
+		if (runComment(binary, root, &seconds[1 - cold], &written[1 - cold]) != 0) {
+			fprintf(stderr, "Could not run '%s'\n", binary);
+			return 2;
+		}
+	}
+
+	if (runComment(binary, root, &seconds[2], &written[2]) != 0) {
+		fprintf(stderr, "Could not run '%s'\n", binary);
+		return 2;
+	}
+
+	removeTree(root);
+
+	fprintf(stdout, "    {\n");
+	fprintf(stdout, "      \"name\": \"%s\",\n", scenario->name);
+	fprintf(stdout, "      \"files\": %d,\n", count);
+	fprintf(stdout, "      \"file_size\": %zu,\n", size);
+	fprintf(stdout, "      \"bytes\": %lld,\n", bytes);
+	fprintf(stdout, "      \"runs\": [\n");
+	printRun("cold", count, bytes, seconds[0], &written[0], 0);
+	printRun("warm", count, bytes, seconds[1], &written[1], 0);
+	printRun("rerun", count, bytes, seconds[2], &written[2], 1);
+	fprintf(stdout, "      ]\n");
+	fprintf(stdout, "    }%s\n", (last ? "" : ","));
+	fflush(stdout);
+
+	fprintf(stderr, "%-18s %7d files  %8.1f files/s cold  %8.1f files/s warm\n", scenario->name, count,
+		(seconds[0] > 0 ? count / seconds[0] : 0.0), (seconds[1] > 0 ? count / seconds[1] : 0.0));
+
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	int quick = 0;
+	const char *directory = NULL;
+	const char *binary = NULL;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp("--quick", argv[i]) == 0) {
+			quick = 1;
+		}
+		else if (strcmp("-d", argv[i]) == 0 && i + 1 < argc) {
+			directory = argv[++i];
+		}
+		else {
+			binary = argv[i];
+		}
+	}
+
+	if (!binary) {
+		fprintf(stderr, "Usage: bench [--quick] [-d directory] path/to/comment\n");
+		return 2;
+	}
+
+	char binaryPath[4096];
+	if (!realpath(binary, binaryPath)) {
+		fprintf(stderr, "Could not find '%s'\n", binary);
+		return 2;
+	}
+
+	char root[4096];
+	const char *tmp = getenv("TMPDIR");
+	snprintf(root, sizeof(root), "%s/comment-bench-%d", (directory ? directory : (tmp ? tmp : "/tmp")), (int)getpid());
+
+	time_t started = time(NULL);
+	char startedText[64];
+	strftime(startedText, sizeof(startedText), "%FT%TZ", gmtime(&started));
+
+	fprintf(stdout, "{\n");
+	fprintf(stdout, "  \"binary\": \"%s\",\n", binaryPath);
+	fprintf(stdout, "  \"started\": \"%s\",\n", startedText);
+	fprintf(stdout, "  \"quick\": %s,\n", (quick ? "true" : "false"));
+	fprintf(stdout, "  \"scenarios\": [\n");
+
+	int result = 0;
+	for (size_t i = 0; i < SCENARIO_COUNT && result == 0; ++i) {
+		result = runScenario(binaryPath, root, &SCENARIOS[i], quick, i + 1 == SCENARIO_COUNT);
+	}
+
+	fprintf(stdout, "  ]\n");
+	fprintf(stdout, "}\n");
+
+	removeTree(root);
+	return result;
+}
@@ -0,0 +1,238 @@
+/**
+ * @file microbench.c
+ * @brief microbenchmark for the scan phase of each file type handler
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+
+/* USAGE
+ * bench/microbench [--quick] > results.json
+ *
+ * Every scanner is run over corpora that are generated in memory, so the
+ * numbers are only about finding the date, not about reading or writing
+ * files. The corpora are the worst cases for each scanner: long files with
+ * no header at all, a lot of slashes and comments that are not a doxygen
+ * header, and lines much longer than the 1024 bytes that fgets() used to
+ * read at a time. A file that starts with a proper header is included as
+ * the best case.
+ *
+ * Each scanner and corpus is timed in a few rounds, and the fastest round
+ * is reported as ns/byte. On x86 the time stamp counter is also read, for
+ * cycles/byte at the TSC rate (which is not necessarily the core clock).
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include "comment_c.h"
+#include "comment_line.h"
+#include "comment_sh.h"
+#include "comment_tex.h"
+#include "comment_makefile.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+#define ROUNDS 5
+
+enum corpus_kind {
+	CORPUS_NO_HEADER,
+	CORPUS_FALSE_STARTS,
+	CORPUS_LONG_LINES,
+	CORPUS_DATED_HEADER
+};
+
+struct microbench_corpus {
+	const char *name;
+	enum corpus_kind kind;
+	char *data;
+	size_t length;
+};
+
+typedef struct microbench_corpus CORPUS;
+
+enum scanner_kind {
+	SCANNER_C,
+	SCANNER_C_HEADER,
+	SCANNER_LINES
+};
+
+struct microbench_scanner {
+	const char *name;
+	enum scanner_kind kind;
+	const LINE_SYNTAX *syntax;
+};
+
+typedef struct microbench_scanner SCANNER;
+
+static const SCANNER SCANNERS[] = {
+	{ "c",          SCANNER_C,        NULL },
+	{ "c-header",   SCANNER_C_HEADER, NULL },
+	{ "sh",         SCANNER_LINES,    &SH_SYNTAX },
+	{ "tex",        SCANNER_LINES,    &TEX_SYNTAX },
+	{ "makefile",   SCANNER_LINES,    &MAKEFILE_SYNTAX }
+};
+
+#define SCANNER_COUNT (sizeof(SCANNERS) / sizeof(SCANNERS[0]))
+
+static CORPUS CORPORA[] = {
+	{ "no-header",    CORPUS_NO_HEADER,    NULL, 0 },
+	{ "false-starts", CORPUS_FALSE_STARTS, NULL, 0 },
+	{ "long-lines",   CORPUS_LONG_LINES,   NULL, 0 },
+	{ "dated-header", CORPUS_DATED_HEADER, NULL, 0 }
+};
+
+#define CORPUS_COUNT (sizeof(CORPORA) / sizeof(CORPORA[0]))
+
+/* Keeps the compiler from throwing the scans away */
+static volatile off_t sink;
+
+static size_t appendText(char *buffer, size_t length, size_t capacity, const char *text) {
+	size_t textLength = strlen(text);
+	if (length + textLength > capacity) textLength = capacity - length;
+	memcpy(&buffer[length], text, textLength);
+	return length + textLength;
+}
+
+static int generateCorpus(CORPUS *corpus, size_t size) {
+	corpus->data = malloc(size);
+	if (!corpus->data) return -1;
+
+	char line[8192];
+	size_t length = 0;
+
+	if (corpus->kind == CORPUS_DATED_HEADER) {
+		length = appendText(corpus->data, length, size,
+			"/" "**\n * @file corpus.c\n * @author Bench\n * @date 2001-01-01\n */\n"
+			"# Date: 2001-01-01\n% Date: 2001-01-01\n");
+	}
+
+	for (int i = 0; length < size; ++i) {
+		switch (corpus->kind) {
+			case CORPUS_NO_HEADER:
+			case CORPUS_DATED_HEADER:
+				snprintf(line, sizeof(line), "static int f%d(int x) { return x * %d + 1; }\n", i, i);
+				break;
+			case CORPUS_FALSE_STARTS:
+				snprintf(line, sizeof(line), "x%d = a / b; /* not a header */ y = c /d; /*x*/ // date\n", i);
+				break;
+			case CORPUS_LONG_LINES:
+				memset(line, 'x', 4000);
+				snprintf(&line[4000], sizeof(line) - 4000, " %d\n", i);
+				break;
+		}
+		length = appendText(corpus->data, length, size, line);
+	}
+
+	corpus->length = length;
+	return 0;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t ticks(void) {
+#if HAVE_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static void scanOnce(const SCANNER *scanner, const CORPUS *corpus) {
+	const char *start = corpus->data;
+	const char *end = start + corpus->length;
+
+	if (scanner->kind == SCANNER_LINES) {
+		LINE_MATCH match;
+		scanLines(start, end, 0, scanner->syntax, &match);
+		sink = match.lineEnd + match.hashBangEnd;
+	}
+	else {
+		off_t indexOfDate;
+		off_t indexOfDateEnd;
+		scanC(start, end, scanner->kind == SCANNER_C_HEADER, &indexOfDate, &indexOfDateEnd);
+		sink = indexOfDate + indexOfDateEnd;
+	}
+}
+
+/* Runs enough scans to fill minSeconds per round, and keeps the best round */
+static void measure(const SCANNER *scanner, const CORPUS *corpus, double minSeconds, double *nsPerByte, double *cyclesPerByte) {
+	*nsPerByte = 0;
+	*cyclesPerByte = 0;
+
+	for (int round = 0; round < ROUNDS; ++round) {
+		long long iterations = 0;
+		double start = now();
+		uint64_t startTicks = ticks();
+		double elapsed;
+
+		do {
+			scanOnce(scanner, corpus);
+			++iterations;
+			elapsed = now() - start;
+		} while (elapsed < minSeconds);
+
+		uint64_t elapsedTicks = ticks() - startTicks;
+		double bytes = (double)corpus->length * iterations;
+		double ns = elapsed * 1e9 / bytes;
+
+		if (round == 0 || ns < *nsPerByte) {
+			*nsPerByte = ns;
+			*cyclesPerByte = elapsedTicks / bytes;
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	int quick = (argc >= 2 && strcmp("--quick", argv[1]) == 0);
+	size_t size = quick ? 1024 * 1024 : 16 * 1024 * 1024;
+	double minSeconds = quick ? 0.01 : 0.1;
+
+	for (size_t i = 0; i < CORPUS_COUNT; ++i) {
+		if (generateCorpus(&CORPORA[i], size) != 0) {
+			fprintf(stderr, "Could not allocate corpus '%s'\n", CORPORA[i].name);
+			return 2;
+		}
+	}
+
+	fprintf(stdout, "{\n");
+	fprintf(stdout, "  \"quick\": %s,\n", (quick ? "true" : "false"));
+	fprintf(stdout, "  \"corpus_bytes\": %zu,\n", size);
+	fprintf(stdout, "  \"tsc\": %s,\n", (HAVE_TSC ? "true" : "false"));
+	fprintf(stdout, "  \"results\": [\n");
+
+	for (size_t s = 0; s < SCANNER_COUNT; ++s) {
+		for (size_t c = 0; c < CORPUS_COUNT; ++c) {
+			double nsPerByte;
+			double cyclesPerByte;
+			measure(&SCANNERS[s], &CORPORA[c], minSeconds, &nsPerByte, &cyclesPerByte);
+
+			int last = (s + 1 == SCANNER_COUNT && c + 1 == CORPUS_COUNT);
+			fprintf(stdout, "    { \"scanner\": \"%s\", \"corpus\": \"%s\", \"ns_per_byte\": %.4f, \"cycles_per_byte\": %.4f }%s\n",
+				SCANNERS[s].name, CORPORA[c].name, nsPerByte, cyclesPerByte, (last ? "" : ","));
+			fprintf(stderr, "%-10s %-14s %8.4f ns/byte %8.4f cycles/byte\n",
+				SCANNERS[s].name, CORPORA[c].name, nsPerByte, cyclesPerByte);
+		}
+	}
+
+	fprintf(stdout, "  ]\n");
+	fprintf(stdout, "}\n");
+
+	for (size_t i = 0; i < CORPUS_COUNT; ++i) {
+		free(CORPORA[i].data);
+	}
+
+	return 0;
+}
@@ -0,0 +1,215 @@
+/**
+ * @file buffer.c
+ * @brief checks that stamping a buffer gives the same text as stamping a file
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+
+/* USAGE
+ * check/buffer [--quick]
+ *
+ * Random texts, made from the pieces that the scanners react to, are
+ * stamped both ways: written to a file and stamped with comment_file(), and
+ * stamped in memory with comment_buffer() under the same name. The results
+ * have to be byte for byte the same, with the same return code. Every text
+ * is tried as each kind of file, with and without a header window.
+ *
+ * The date format is just the year, and the files are given the current
+ * time, so both ways stamp the same date.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "libcomment.h"
+
+#define TEXTS 300
+#define QUICK_TEXTS 50
+#define MAX_PIECES 300
+
+static const char * const NAMES[] = { "check.c", "check.sh", "check.tex", "makefile", "check.hpp" };
+#define NAME_COUNT (sizeof(NAMES) / sizeof(NAMES[0]))
+
+static const char * const PIECES[] = {
+	"/", "*", "@", "date", "d", "a", "t", "e", " ", "\t", "\n", "x", "/**", "*/",
+	"#", "%", "# Date: q\n", "%date: z\n", "#!", "@date ", "# date:", "\r\n"
+};
+#define PIECE_COUNT (sizeof(PIECES) / sizeof(PIECES[0]))
+
+static uint64_t seed = 0x9E3779B97F4A7C15ULL;
+
+/* Stamping messages go to stderr, and are not what is checked */
+static int quiet = -1;
+static int savedStderr = -1;
+
+static void silence(void) {
+	fflush(stderr);
+	dup2(quiet, STDERR_FILENO);
+}
+
+static void unsilence(void) {
+	fflush(stderr);
+	dup2(savedStderr, STDERR_FILENO);
+}
+
+static unsigned int nextRandom(unsigned int below) {
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+	return (unsigned int)(seed % below);
+}
+
+static size_t makeText(char *text, size_t capacity) {
+	size_t length = 0;
+	int pieces = nextRandom(MAX_PIECES + 1);
+
+	for (int i = 0; i < pieces; ++i) {
+		int kind = nextRandom(PIECE_COUNT + 2);
+		if (kind < (int)PIECE_COUNT) {
+			size_t size = strlen(PIECES[kind]);
+			if (length + size > capacity) break;
+			memcpy(&text[length], PIECES[kind], size);
+			length += size;
+		}
+		else {
+			/* Runs of a single character, for long lines and lots of blanks */
+			size_t size = nextRandom(100);
+			if (length + size > capacity) break;
+			memset(&text[length], (kind == (int)PIECE_COUNT) ? 'x' : ' ', size);
+			length += size;
+		}
+	}
+
+	return length;
+}
+
+static int writeFile(const char *filename, const char *text, size_t length) {
+	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) return -1;
+
+	int result = (write(fd, text, length) == (ssize_t)length) ? 0 : -1;
+	if (close(fd) != 0) result = -1;
+	return result;
+}
+
+static char *readFile(const char *filename, size_t *length) {
+	FILE *f = fopen(filename, "rb");
+	if (!f) return NULL;
+
+	size_t capacity = 65536;
+	char *data = malloc(capacity);
+	*length = 0;
+	while (data) {
+		*length += fread(&data[*length], 1, capacity - *length, f);
+		if (*length < capacity) break;
+		char *grown = realloc(data, capacity * 2);
+		if (!grown) {
+			free(data);
+			data = NULL;
+			break;
+		}
+		data = grown;
+		capacity *= 2;
+	}
+
+	fclose(f);
+	return data;
+}
+
+static int checkText(COMMENT_CONTEXT *context, const char *name, const char *text, size_t length, int index, off_t window) {
+	if (writeFile(name, text, length) != 0) {
+		fprintf(stderr, "Could not write '%s': %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	silence();
+	int fileResult = comment_file(context, name);
+	unsilence();
+	size_t stampedLength;
+	char *stamped = readFile(name, &stampedLength);
+	unlink(name);
+	if (!stamped) {
+		fprintf(stderr, "Could not read '%s' back\n", name);
+		return -1;
+	}
+
+	COMMENT_BUFFER out;
+	memset(&out, 0, sizeof(out));
+	silence();
+	int bufferResult = comment_buffer(context, NULL, name, text, length, &out);
+	unsilence();
+
+	int same = fileResult == bufferResult && stampedLength == out.length &&
+		memcmp(stamped, out.data, stampedLength) == 0;
+	if (!same) {
+		fprintf(stderr, "Text %d as '%s' with header window %lld differs: file gave %d and %zu bytes, buffer gave %d and %zu bytes\n",
+			index, name, (long long)window, fileResult, stampedLength, bufferResult, out.length);
+	}
+
+	free(out.data);
+	free(stamped);
+	return same ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+	int texts = (argc >= 2 && strcmp("--quick", argv[1]) == 0) ? QUICK_TEXTS : TEXTS;
+
+	char directory[] = "/tmp/comment-check-XXXXXX";
+	if (!mkdtemp(directory) || chdir(directory) != 0) {
+		fprintf(stderr, "Could not create a directory to check in: %s\n", strerror(errno));
+		return 2;
+	}
+
+	COMMENT_CONFIG config;
+	comment_config_defaults(&config);
+	strcpy(config.author, "Checker");
+	strcpy(config.dateformat, "%Y");
+
+	quiet = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	savedStderr = dup(STDERR_FILENO);
+
+	static char text[MAX_PIECES * 100];
+	int failures = 0;
+	int checks = 0;
+	const off_t windows[2] = { 0, 100 };
+	for (int w = 0; w < 2 && failures >= 0; ++w) {
+		config.headerwindow = windows[w];
+		COMMENT_CONTEXT *context = comment_create(&config);
+		if (!context) {
+			fprintf(stderr, "Could not create a context: %s\n", strerror(errno));
+			failures = -1;
+			break;
+		}
+
+		seed = 0x9E3779B97F4A7C15ULL;
+		for (int i = 0; i < texts && failures >= 0; ++i) {
+			size_t length = makeText(text, sizeof(text));
+			for (size_t n = 0; n < NAME_COUNT; ++n) {
+				int result = checkText(context, NAMES[n], text, length, i, windows[w]);
+				if (result < 0) {
+					failures = -1;
+					break;
+				}
+				failures += result;
+				++checks;
+			}
+		}
+
+		comment_destroy(context);
+	}
+
+	close(quiet);
+	close(savedStderr);
+	if (chdir("/") == 0) rmdir(directory);
+
+	if (failures < 0) return 2;
+	fprintf(stdout, "buffer: %d checks, %d differ\n", checks, failures);
+	return failures > 0 ? 1 : 0;
+}
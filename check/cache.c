@@ -0,0 +1,141 @@
+/**
+ * @file cache.c
+ * @brief checks that a context finds the files it stamped itself in its cache
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+
+/* USAGE
+ * check/cache [--quick]
+ *
+ * A file is stamped through a context with a cache, and then stamped again
+ * through the same context. The second time has to be a cache hit, which
+ * is told apart from an ordinary "already current" by changing the date in
+ * the file behind the cache's back, keeping its size and modification
+ * time: a hit leaves the change alone, anything else stamps it back. The
+ * hit must not add another record to the cache file either.
+ *
+ * There is nothing random in here, so --quick changes nothing.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "libcomment.h"
+
+#define CACHE_NAME ".comment-cache"
+#define FILE_NAME "check.sh"
+#define OLD_YEAR "1999"
+
+static int writeFile(const char *filename, const char *text) {
+	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) return -1;
+
+	size_t length = strlen(text);
+	int result = (write(fd, text, length) == (ssize_t)length) ? 0 : -1;
+	if (close(fd) != 0) result = -1;
+	return result;
+}
+
+static int readFile(const char *filename, char *text, size_t size) {
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return -1;
+
+	ssize_t length = read(fd, text, size - 1);
+	close(fd);
+	if (length < 0) return -1;
+	text[length] = '\0';
+	return 0;
+}
+
+static off_t sizeOf(const char *filename) {
+	struct stat st;
+	return (stat(filename, &st) == 0) ? st.st_size : -1;
+}
+
+/* Puts the old year back in the date line, without the cache seeing it */
+static int changeBehindCache(const char *filename) {
+	struct stat st;
+	char text[256];
+	if (stat(filename, &st) != 0 || readFile(filename, text, sizeof(text)) != 0) return -1;
+
+	char *year = strstr(text, "Date: ");
+	if (!year || strlen(year) < 6 + strlen(OLD_YEAR)) return -1;
+	memcpy(year + 6, OLD_YEAR, strlen(OLD_YEAR));
+	if (writeFile(filename, text) != 0) return -1;
+
+	struct timespec times[2] = { st.st_atim, st.st_mtim };
+	return utimensat(AT_FDCWD, filename, times, 0);
+}
+
+static int check(COMMENT_CONTEXT *context) {
+	if (writeFile(FILE_NAME, "# Date: " OLD_YEAR "\necho check\n") != 0 || comment_file(context, FILE_NAME) != 0) {
+		fprintf(stderr, "Could not stamp '%s' the first time\n", FILE_NAME);
+		return -1;
+	}
+	if (comment_flush(context) != 0) return -1;
+	off_t cacheSize = sizeOf(CACHE_NAME);
+
+	char text[256];
+	if (changeBehindCache(FILE_NAME) != 0) {
+		fprintf(stderr, "Could not change '%s': %s\n", FILE_NAME, strerror(errno));
+		return -1;
+	}
+
+	COMMENT_COUNTERS before;
+	COMMENT_COUNTERS after;
+	comment_counters(context, &before);
+	int result = comment_file(context, FILE_NAME);
+	comment_counters(context, &after);
+	if (comment_flush(context) != 0 || readFile(FILE_NAME, text, sizeof(text)) != 0) return -1;
+
+	int failures = 0;
+	if (result != 0 || after.skipped != before.skipped + 1 || strncmp(text, "# Date: " OLD_YEAR "\n", 13) != 0) {
+		fprintf(stderr, "Stamping '%s' again was not a cache hit, it gave %d and:\n%s", FILE_NAME, result, text);
+		++failures;
+	}
+	if (sizeOf(CACHE_NAME) != cacheSize) {
+		fprintf(stderr, "The cache hit added to the cache file, from %lld to %lld bytes\n",
+			(long long)cacheSize, (long long)sizeOf(CACHE_NAME));
+		++failures;
+	}
+	return failures;
+}
+
+int main(int argc, char *argv[]) {
+	char directory[] = "/tmp/comment-check-XXXXXX";
+	if (!mkdtemp(directory) || chdir(directory) != 0) {
+		fprintf(stderr, "Could not create a directory to check in: %s\n", strerror(errno));
+		return 2;
+	}
+
+	COMMENT_CONFIG config;
+	comment_config_defaults(&config);
+	strcpy(config.author, "Checker");
+	strcpy(config.dateformat, "%Y");
+	config.cacheEnabled = 1;
+
+	int failures = -1;
+	COMMENT_CONTEXT *context = comment_create(&config);
+	if (!context || comment_open_cache(context, CACHE_NAME) != 0) {
+		fprintf(stderr, "Could not create a context with a cache: %s\n", strerror(errno));
+	}
+	else {
+		failures = check(context);
+	}
+	if (context) comment_destroy(context);
+
+	unlink(FILE_NAME);
+	unlink(CACHE_NAME);
+	if (chdir("/") == 0) rmdir(directory);
+
+	if (failures < 0) return 2;
+	fprintf(stdout, "cache: 1 check, %d failed\n", failures);
+	return failures > 0 ? 1 : 0;
+}
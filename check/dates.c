@@ -0,0 +1,182 @@
+/**
+ * @file dates.c
+ * @brief checks the cached date rendering against localtime_r() and strftime()
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+
+/* USAGE
+ * check/dates [--quick]
+ *
+ * For every format and time zone, a few threads share one DATES and render
+ * times with it, and every text has to be exactly what localtime_r() and
+ * strftime() give for the same time. Half of the times are anywhere in
+ * 2019-2027, the other half are within a day and a half of a change of UTC
+ * offset in that zone, which is where a cached range is most likely to be
+ * wrong. Each time is followed by a few close to it, so the thread's last
+ * range gets used as well.
+ *
+ * The zones have daylight saving in both hemispheres, a 30 minute daylight
+ * saving shift, and a half hour offset. A zone that isn't installed is
+ * skipped.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "comment_date.h"
+
+#define THREADS 4
+#define CHECKS 10000
+#define QUICK_CHECKS 1000
+#define MAX_CHANGES 64
+#define NEARBY 4
+
+#define FIRST_TIME 1546300800
+#define LAST_TIME 1830297600
+
+static const char * const FORMATS[] = {
+	"%F", "%y%m%d%H%M", "%Y", "%b %Y", "%F %H:%M:%S", "%F %Z", "%c",
+	"%G-W%V", "%s", "%I %p", "%R", "%-d.%-m.%Y", "release", "%Ez %Od", "%Y %Z", "%Y%z"
+};
+#define FORMAT_COUNT (sizeof(FORMATS) / sizeof(FORMATS[0]))
+
+static const char * const ZONES[] = {
+	"UTC", "Europe/Stockholm", "America/Santiago", "Australia/Lord_Howe", "Asia/Kolkata"
+};
+#define ZONE_COUNT (sizeof(ZONES) / sizeof(ZONES[0]))
+
+struct check_run {
+	DATES *dates;
+	const char *format;
+	const time_t *changes;
+	int changeCount;
+	int checks;
+	uint64_t seed;
+	long mismatches;
+};
+
+static unsigned int nextRandom(uint64_t *seed, unsigned int below) {
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 7;
+	*seed ^= *seed << 17;
+	return (unsigned int)(*seed % below);
+}
+
+/* Every change of UTC offset (or daylight saving) in the zone, to the hour */
+static int findChanges(time_t *changes) {
+	int count = 0;
+	struct tm before;
+	time_t time = FIRST_TIME;
+	localtime_r(&time, &before);
+
+	for (time += 3600; time < LAST_TIME && count < MAX_CHANGES; time += 3600) {
+		struct tm tm;
+		localtime_r(&time, &tm);
+		if (tm.tm_gmtoff != before.tm_gmtoff || tm.tm_isdst != before.tm_isdst) {
+			changes[count++] = time;
+		}
+		before = tm;
+	}
+
+	return count;
+}
+
+static int checkTime(struct check_run *run, time_t time) {
+	struct tm tm;
+	char expected[256];
+	size_t length = localtime_r(&time, &tm) ? strftime(expected, sizeof(expected), run->format, &tm) : 0;
+	const char *text = datesFormat(run->dates, time);
+
+	if (length == 0 ? text == NULL : (text != NULL && strcmp(expected, text) == 0)) return 0;
+
+	if (run->mismatches < 5) {
+		fprintf(stderr, "'%s' at %lld in %s: expected '%s', got '%s'\n", run->format, (long long)time,
+			getenv("TZ"), (length ? expected : "(nothing)"), (text ? text : "(nothing)"));
+	}
+	return 1;
+}
+
+static void *checkThread(void *arg) {
+	struct check_run *run = (struct check_run *)arg;
+
+	for (int i = 0; i < run->checks; ++i) {
+		time_t time;
+		if (i % 2 == 0 || run->changeCount == 0) {
+			time = FIRST_TIME + (time_t)nextRandom(&run->seed, LAST_TIME - FIRST_TIME);
+		}
+		else {
+			time = run->changes[nextRandom(&run->seed, run->changeCount)] +
+				(time_t)nextRandom(&run->seed, 3 * 86400) - 3 * 43200;
+		}
+
+		for (int n = 0; n < NEARBY; ++n) {
+			run->mismatches += checkTime(run, time);
+			time += nextRandom(&run->seed, 7200);
+		}
+	}
+
+	return NULL;
+}
+
+int main(int argc, char *argv[]) {
+	int checks = (argc >= 2 && strcmp("--quick", argv[1]) == 0) ? QUICK_CHECKS : CHECKS;
+	long total = 0;
+	long mismatches = 0;
+	int zones = 0;
+
+	for (size_t z = 0; z < ZONE_COUNT; ++z) {
+		char zoneFile[256];
+		snprintf(zoneFile, sizeof(zoneFile), "/usr/share/zoneinfo/%s", ZONES[z]);
+		if (access(zoneFile, R_OK) != 0) {
+			fprintf(stderr, "Time zone %s is not installed, skipping it\n", ZONES[z]);
+			continue;
+		}
+
+		setenv("TZ", ZONES[z], 1);
+		tzset();
+		time_t changes[MAX_CHANGES];
+		int changeCount = findChanges(changes);
+		++zones;
+
+		for (size_t f = 0; f < FORMAT_COUNT; ++f) {
+			DATES *dates = datesCreate(FORMATS[f]);
+			if (!dates) {
+				fprintf(stderr, "Could not create dates for '%s'\n", FORMATS[f]);
+				return 2;
+			}
+
+			struct check_run runs[THREADS];
+			pthread_t threads[THREADS];
+			for (int t = 0; t < THREADS; ++t) {
+				runs[t].dates = dates;
+				runs[t].format = FORMATS[f];
+				runs[t].changes = changes;
+				runs[t].changeCount = changeCount;
+				runs[t].checks = checks;
+				runs[t].seed = 0x9E3779B97F4A7C15ULL * (z * FORMAT_COUNT * THREADS + f * THREADS + t + 1);
+				runs[t].mismatches = 0;
+				if (pthread_create(&threads[t], NULL, checkThread, &runs[t]) != 0) {
+					fprintf(stderr, "Could not start a thread\n");
+					return 2;
+				}
+			}
+
+			for (int t = 0; t < THREADS; ++t) {
+				pthread_join(threads[t], NULL);
+				mismatches += runs[t].mismatches;
+				total += (long)checks * NEARBY;
+			}
+
+			datesDestroy(dates);
+		}
+	}
+
+	fprintf(stdout, "dates: %ld checks in %d time zones, %ld mismatches\n", total, zones, mismatches);
+	return mismatches > 0 ? 1 : 0;
+}
@@ -1,8 +1,8 @@
 /**
  * @file comment.c
- * @brief main program for comment tool
+ * @brief main program for comment tool, on top of libcomment
  * @author Anders Tornblad
- * @date 2017-08-30
+ * @date 2026-10-18
  */
 
 /* IDEA:
@@ -10,110 +10,673 @@
  * comment --config global dateformat %F
  * comment --config name "anto1700"
  * comment --config dateformat %y%m%d%H%M
+ * comment --config headerwindow 8192
+ * comment --config cache on
+ * comment --config uring off
+ * comment --check -r .
+ * comment --stats -r .
+ * comment --trace run.json -r .
+ * comment --watch src
+ * comment --serve /tmp/comment.sock
+ * comment --client /tmp/comment.sock file.c
+ * git ls-files -z | comment --files-from - -0
+ * comment --stdin --lang c --name foo.c < foo.c > stamped.c
  * comment --help
  */
 
-#define _XOPEN_SOURCE
-#define _XOPEN_SOURCE_EXTENDED
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <pthread.h>
 #include "comment.h"
-#include "comment_c.h"
-#include "comment_makefile.h"
-#include "comment_tex.h"
-#include "comment_sh.h"
-
-static int comment(const char *filename);
+#include "comment_pool.h"
+#include "comment_walk.h"
+#include "comment_uring.h"
+#include "comment_stats.h"
+#include "comment_trace.h"
+#include "comment_watch.h"
+#include "comment_serve.h"
+#include "comment_jobs.h"
+
+static int comment(const char *filename, int discovered, PREFETCH *prefetched);
+static int commentAll(int count, char **filenames, int jobs, int recursive, const char *filesFrom, int delimiter);
+static void commentWatched(const char *path, void *user);
+static void commentServed(int count, char **paths, unsigned char *results, void *user);
 static int setConfig(int argc, const char **args);
-static void readConfig(int globalOnly);
+static void recordStale(const char *filename, void *user);
+static int commentStdin(const char *lang, const char *name);
+static void closeServed(void);
 
-static char author[256];
-static int authorIsGlobal;
-static int authorIsDefault;
+/* The command line is one run with one context, shared by all workers */
+static COMMENT_CONFIG config;
+static COMMENT_CONTEXT *context;
+static int checkOnly;
 
-static char dateformat[256];
-static int dateformatIsGlobal;
-static int dateformatIsDefault;
+static const char * const CACHE_FILENAME = "./.comment-cache";
 
 int main(int argc, char *argv[]) {
 	if (argc >= 2 && strcmp("--config", argv[1]) == 0) {
 		return setConfig(argc - 2, (const char **)&argv[2]);
 	}
 	else {
-		readConfig(0);
+		int jobs = poolOnlineCpus();
+		int recursive = 0;
+		int first = 1;
+		const char *traceFilename = NULL;
+		int watching = 0;
+		const char *serveSocket = NULL;
+		const char *clientSocket = NULL;
+		const char *filesFrom = NULL;
+		int delimiter = '\n';
+		int filtering = 0;
+		const char *lang = NULL;
+		const char *name = NULL;
+
+		while (first < argc && argv[first][0] == '-') {
+			if (strcmp("-r", argv[first]) == 0) {
+				recursive = 1;
+				++first;
+			}
+			else if (strcmp("-j", argv[first]) == 0 && first + 1 < argc) {
+				jobs = atoi(argv[first + 1]);
+				first += 2;
+			}
+			else if (strncmp("-j", argv[first], 2) == 0 && argv[first][2] != '\0') {
+				jobs = atoi(&argv[first][2]);
+				++first;
+			}
+			else if (strcmp("--stats", argv[first]) == 0) {
+				statsStart();
+				++first;
+			}
+			else if (strcmp("--trace", argv[first]) == 0 && first + 1 < argc) {
+				traceFilename = argv[first + 1];
+				first += 2;
+			}
+			else if (strcmp("--watch", argv[first]) == 0) {
+				watching = 1;
+				++first;
+			}
+			else if (strcmp("--serve", argv[first]) == 0 && first + 1 < argc) {
+				serveSocket = argv[first + 1];
+				first += 2;
+			}
+			else if (strcmp("--client", argv[first]) == 0 && first + 1 < argc) {
+				clientSocket = argv[first + 1];
+				first += 2;
+			}
+			else if (strcmp("--files-from", argv[first]) == 0 && first + 1 < argc) {
+				filesFrom = argv[first + 1];
+				first += 2;
+			}
+			else if (strcmp("-0", argv[first]) == 0) {
+				delimiter = '\0';
+				++first;
+			}
+			else if (strcmp("--stdin", argv[first]) == 0) {
+				filtering = 1;
+				++first;
+			}
+			else if (strcmp("--lang", argv[first]) == 0 && first + 1 < argc) {
+				lang = argv[first + 1];
+				first += 2;
+			}
+			else if (strcmp("--name", argv[first]) == 0 && first + 1 < argc) {
+				name = argv[first + 1];
+				first += 2;
+			}
+			else if (strcmp("--check", argv[first]) == 0) {
+				checkOnly = 1;
+				++first;
+			}
+			else if (strcmp("--", argv[first]) == 0) {
+				++first;
+				break;
+			}
+			else {
+				break;
+			}
+		}
 
-		int retcode = 0;
-		for (int i = 1; i < argc; ++i) {
-			int result = comment(argv[i]);
-			if (result > retcode) retcode = result;
+		if (jobs < 1) {
+			fprintf(stderr, "The number of jobs must be at least 1\n");
+			return 2;
+		}
+		if (delimiter == '\0' && !filesFrom) {
+			fprintf(stderr, "-0 only applies to --files-from\n");
+			return 2;
+		}
+		if ((lang || name) && !filtering) {
+			fprintf(stderr, "--lang and --name only apply to --stdin\n");
+			return 2;
+		}
+		if (filtering && (first < argc || recursive || filesFrom || watching || serveSocket || clientSocket)) {
+			fprintf(stderr, "--stdin can't be combined with files, -r, --files-from, --watch, --serve or --client\n");
+			return 2;
 		}
 
-		return retcode;
+		/* Plain files are handed to the server before anything is read, which
+		 * is the whole point. Without a server they are handled right here. */
+		if (clientSocket && !recursive && !watching && !serveSocket && !filesFrom && !checkOnly && !statsEnabled && !traceFilename) {
+			int result = serveClient(clientSocket, argc - first, &argv[first]);
+			if (result >= 0) return result;
+		}
+
+		if (traceFilename && traceOpen(traceFilename) != 0) {
+			fprintf(stderr, "Could not open trace file '%s': %s\n", traceFilename, strerror(errno));
+			return 2;
+		}
+
+		/* The server reads the configuration of each client's directory instead */
+		if (serveSocket) {
+			int result = serveRun(serveSocket, commentServed, NULL);
+			closeServed();
+			statsReport(stderr);
+			if (traceClose() != 0) {
+				fprintf(stderr, "Could not write trace file '%s'\n", traceFilename);
+				if (result < 2) result = 2;
+			}
+			return result;
+		}
+
+		comment_config_load(&config, 0);
+		context = comment_create(&config);
+		if (!context) {
+			fprintf(stderr, "Could not start: %s\n", strerror(errno));
+			return 2;
+		}
+		if (checkOnly) {
+			/* A filter's stdout is the text itself, so no list of stale files there */
+			comment_set_check(context, (filtering ? NULL : recordStale), NULL);
+		}
+		if (filtering) {
+			int result = commentStdin(lang, name);
+			comment_destroy(context);
+			statsReport(stderr);
+			if (traceClose() != 0) {
+				fprintf(stderr, "Could not write trace file '%s'\n", traceFilename);
+				if (result < 2) result = 2;
+			}
+			return result;
+		}
+		if (comment_open_cache(context, CACHE_FILENAME) != 0) {
+			fprintf(stderr, "Could not open cache file '%s', continuing without it\n", CACHE_FILENAME);
+		}
+
+		/* Watching keeps the configuration read above for as long as it runs */
+		int result;
+		if (watching) {
+			result = watchRun(argc - first, &argv[first], commentWatched, NULL);
+		}
+		else {
+			result = commentAll(argc - first, &argv[first], jobs, recursive, filesFrom, delimiter);
+		}
+
+		comment_destroy(context);
+		statsReport(stderr);
+		if (traceClose() != 0) {
+			fprintf(stderr, "Could not write trace file '%s'\n", traceFilename);
+			if (result < 2) result = 2;
+		}
+		return result;
+	}
+}
+
+static pthread_mutex_t retcodeLock = PTHREAD_MUTEX_INITIALIZER;
+static int retcode;
+
+static void recordResult(int result) {
+	pthread_mutex_lock(&retcodeLock);
+	if (result > retcode) retcode = result;
+	pthread_mutex_unlock(&retcodeLock);
+}
+
+/* In check mode, files that would have been stamped are listed on stdout */
+static void recordStale(const char *filename, void *user) {
+	fprintf(stdout, "%s\n", filename);
+}
+
+static void reportSkipped(unsigned long skippedFiles) {
+	if (skippedFiles > 0 && !checkOnly) {
+		fprintf(stdout, "Skipped %lu file%s that already had the current date\n",
+			skippedFiles, (skippedFiles == 1 ? "" : "s"));
+	}
+}
+
+static unsigned long skippedSoFar(COMMENT_CONTEXT *counted) {
+	COMMENT_COUNTERS counters;
+	comment_counters(counted, &counters);
+	return counters.skipped;
+}
+
+/* A file from the ring is already open, anything else is opened when handled */
+static int comment(const char *filename, int discovered, PREFETCH *prefetched) {
+	if (prefetched && prefetched->ready) {
+		return commentPath(context, filename, discovered, &prefetched->view, &prefetched->stat);
+	}
+	return commentPath(context, filename, discovered, NULL, NULL);
+}
+
+static void commentTask(void *arg) {
+	recordResult(comment((const char *)arg, 0, NULL));
+}
+
+static void commentDiscovered(const char *path, void *user) {
+	recordResult(comment(path, 1, NULL));
+}
+
+/* Saves come in now and then, so each one goes into the cache file right away */
+static void commentWatched(const char *path, void *user) {
+	comment(path, 1, NULL);
+	comment_flush(context);
+}
+
+/* SERVED DIRECTORIES
+ * A local run reads ./.comment-data and uses ./.comment-cache in the
+ * directory it starts in, so the server keeps a context for each directory
+ * its clients run in, made the same way. Before a request is handled, the
+ * configuration files are looked at again, and if either of them (or the
+ * client's TZ) has changed the context is made over. Only the
+ * SERVED_DIRECTORIES most recently used directories keep their context.
+ */
+
+#define SERVED_DIRECTORIES 16
+
+struct config_stamp {
+	int found;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+};
+
+struct served_directory {
+	char *directory;
+	char *timezone;
+	struct config_stamp stamps[2];
+	COMMENT_CONTEXT *context;
+	unsigned long lastUsed;
+};
+
+static struct served_directory served[SERVED_DIRECTORIES];
+static unsigned long servedRequests;
+
+static void stampConfig(int global, struct config_stamp *stamp) {
+	char filename[1024];
+	struct stat st;
+	memset(stamp, 0, sizeof(struct config_stamp));
+	if (comment_config_filename(global, filename, sizeof(filename)) != 0 || stat(filename, &st) != 0) return;
+
+	stamp->found = 1;
+	stamp->dev = st.st_dev;
+	stamp->ino = st.st_ino;
+	stamp->size = st.st_size;
+	stamp->mtime = st.st_mtim;
+}
+
+static int sameStamp(const struct config_stamp *a, const struct config_stamp *b) {
+	return a->found == b->found && a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+		a->mtime.tv_sec == b->mtime.tv_sec && a->mtime.tv_nsec == b->mtime.tv_nsec;
+}
+
+static int sameString(const char *a, const char *b) {
+	return (!a || !b) ? a == b : strcmp(a, b) == 0;
+}
+
+static void forgetServed(struct served_directory *entry) {
+	comment_destroy(entry->context);
+	free(entry->directory);
+	free(entry->timezone);
+	memset(entry, 0, sizeof(struct served_directory));
+}
+
+static void closeServed(void) {
+	for (int i = 0; i < SERVED_DIRECTORIES; ++i) {
+		if (served[i].context) forgetServed(&served[i]);
 	}
 }
 
-static void readConfigFile(const char *filename, int global) {
-	FILE *f = fopen(filename, "r");
-	if (!f) return;
+/* The context for the working directory, which the request is handled in */
+static COMMENT_CONTEXT *servedContext(void) {
+	char directory[4096];
+	if (!getcwd(directory, sizeof(directory))) return NULL;
+	const char *timezone = getenv("TZ");
 
-	char key[256];
-	char value[256];
+	struct config_stamp stamps[2];
+	stampConfig(0, &stamps[0]);
+	stampConfig(1, &stamps[1]);
 
-	while (fgets(key, 256, f) != NULL) {
-		int len = strlen(key);
-		if (key[len - 1] == '\n') key[len - 1] = '\0';
+	struct served_directory *entry = NULL;
+	for (int i = 0; i < SERVED_DIRECTORIES && !entry; ++i) {
+		if (served[i].context && strcmp(served[i].directory, directory) == 0) entry = &served[i];
+	}
+	if (entry && sameString(entry->timezone, timezone) &&
+			sameStamp(&entry->stamps[0], &stamps[0]) && sameStamp(&entry->stamps[1], &stamps[1])) {
+		entry->lastUsed = ++servedRequests;
+		return entry->context;
+	}
 
-		if (fgets(value, 256, f) != NULL) {
-			len = strlen(value);
-			if (value[len - 1] == '\n') value[len - 1] = '\0';
+	/* Changed, or not seen lately, so the least recently used one makes room */
+	if (!entry) {
+		entry = &served[0];
+		for (int i = 1; i < SERVED_DIRECTORIES; ++i) {
+			if (served[i].lastUsed < entry->lastUsed) entry = &served[i];
+		}
+	}
+	if (entry->context) forgetServed(entry);
+
+	COMMENT_CONFIG loaded;
+	comment_config_load(&loaded, 0);
+	entry->context = comment_create(&loaded);
+	entry->directory = strdup(directory);
+	entry->timezone = timezone ? strdup(timezone) : NULL;
+	if (!entry->context || !entry->directory || (timezone && !entry->timezone)) {
+		forgetServed(entry);
+		return NULL;
+	}
+	entry->stamps[0] = stamps[0];
+	entry->stamps[1] = stamps[1];
+	entry->lastUsed = ++servedRequests;
+
+	if (checkOnly) comment_set_check(entry->context, recordStale, NULL);
 
-			if (strcmp("author", key) == 0) {
-				strcpy(author, value);
-				authorIsGlobal = global;
-				authorIsDefault = 0;
+	/* The cache is written when the context goes, from wherever the server is then */
+	char cacheFilename[4096 + 32];
+	snprintf(cacheFilename, sizeof(cacheFilename), "%s/%s", directory, CACHE_FILENAME);
+	if (comment_open_cache(entry->context, cacheFilename) != 0) {
+		fprintf(stderr, "Could not open cache file '%s', continuing without it\n", CACHE_FILENAME);
+	}
+
+	return entry->context;
+}
+
+/* Requests are handled one at a time, so the skipped files of this one are
+ * the ones counted while it was handled */
+static void commentServed(int count, char **paths, unsigned char *results, void *user) {
+	COMMENT_CONTEXT *directoryContext = servedContext();
+	if (!directoryContext) {
+		fprintf(stderr, "Could not start: %s\n", strerror(errno));
+		memset(results, 2, count);
+		return;
+	}
+
+	unsigned long skippedBefore = skippedSoFar(directoryContext);
+	for (int i = 0; i < count; ++i) {
+		results[i] = (unsigned char)commentPath(directoryContext, paths[i], 0, NULL, NULL);
+	}
+	reportSkipped(skippedSoFar(directoryContext) - skippedBefore);
+	comment_flush(directoryContext);
+}
+
+/* Below this many files, setting up a ring costs more than it saves */
+#define URING_MIN_FILES 16
+
+/* How many prefetched files may wait for a worker before more are read */
+#define PREFETCH_AHEAD (4 * URING_BATCH)
+
+static pthread_mutex_t prefetchLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetchDrained = PTHREAD_COND_INITIALIZER;
+static int prefetchInFlight;
+
+static void commentPrefetched(void *arg) {
+	PREFETCH *file = (PREFETCH *)arg;
+	recordResult(comment(file->filename, 0, file));
+
+	pthread_mutex_lock(&prefetchLock);
+	--prefetchInFlight;
+	pthread_cond_signal(&prefetchDrained);
+	pthread_mutex_unlock(&prefetchLock);
+}
+
+/* Opens and reads the files a batch at a time through the ring, and hands
+ * them to the pool (or handles them right here without one) */
+static int commentBatched(POOL *pool, URING *ring, int count, char **filenames) {
+	PREFETCH *files = calloc(count, sizeof(PREFETCH));
+	if (!files) return -1;
+
+	for (int start = 0; start < count; start += URING_BATCH) {
+		int batch = (count - start < URING_BATCH) ? count - start : URING_BATCH;
+		for (int i = start; i < start + batch; ++i) {
+			files[i].filename = filenames[i];
+		}
+
+		if (pool) {
+			pthread_mutex_lock(&prefetchLock);
+			while (prefetchInFlight > PREFETCH_AHEAD) {
+				pthread_cond_wait(&prefetchDrained, &prefetchLock);
 			}
-			else if (strcmp("dateformat", key) == 0) {
-				strcpy(dateformat, value);
-				dateformatIsGlobal = global;
-				dateformatIsDefault = 0;
+			prefetchInFlight += batch;
+			pthread_mutex_unlock(&prefetchLock);
+		}
+
+		/* Files the ring couldn't prepare are simply opened again by comment() */
+		uringPrefetch(ring, batch, &files[start]);
+
+		for (int i = start; i < start + batch; ++i) {
+			if (pool) {
+				poolSubmit(pool, commentPrefetched, &files[i]);
+			}
+			else {
+				recordResult(comment(files[i].filename, 0, &files[i]));
 			}
 		}
-		else {
+	}
+
+	if (pool) poolWait(pool);
+	free(files);
+
+	return 0;
+}
+
+/* Reads all of stdin and writes it to stdout, stamped if it can be. On any
+ * error the text still comes out unchanged, so a filter never loses it. */
+static int commentStdin(const char *lang, const char *name) {
+	if (!lang && !name) {
+		fprintf(stderr, "Filtering stdin needs --lang or --name to know what kind of text it is\n");
+		return 2;
+	}
+
+	size_t capacity = 65536;
+	size_t length = 0;
+	char *in = malloc(capacity);
+	while (in) {
+		if (length == capacity) {
+			char *grown = realloc(in, capacity * 2);
+			if (!grown) {
+				free(in);
+				in = NULL;
+				break;
+			}
+			in = grown;
+			capacity *= 2;
+		}
+
+		ssize_t count = read(STDIN_FILENO, &in[length], capacity - length);
+		if (count < 0 && errno == EINTR) continue;
+		if (count < 0) {
+			fprintf(stderr, "Could not read stdin: %s\n", strerror(errno));
+			free(in);
+			return 2;
+		}
+		if (count == 0) break;
+		length += count;
+	}
+	if (!in) {
+		fprintf(stderr, "Out of memory while reading stdin\n");
+		return 2;
+	}
+
+	COMMENT_BUFFER out;
+	memset(&out, 0, sizeof(out));
+	int result = comment_buffer(context, lang, name, in, length, &out);
+
+	const char *text = (out.length > 0 || length == 0) ? out.data : in;
+	size_t textLength = (out.length > 0 || length == 0) ? out.length : length;
+	if (textLength > 0 && fwrite(text, 1, textLength, stdout) != textLength) {
+		fprintf(stderr, "Could not write stdout: %s\n", strerror(errno));
+		result = 2;
+	}
+	if (fflush(stdout) != 0 && result < 2) result = 2;
+
+	free(out.data);
+	free(in);
+	return result;
+}
+
+/* How many streamed paths may wait for a worker before more are read */
+#define STREAM_AHEAD 4096
+
+static pthread_mutex_t streamLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t streamDrained = PTHREAD_COND_INITIALIZER;
+static int streamInFlight;
+static JOBS *streamJobs;
+
+static void commentStreamed(void *arg) {
+	JOB *job = (JOB *)arg;
+	recordResult(comment(job->path, 0, NULL));
+	jobsDone(streamJobs, job);
+
+	pthread_mutex_lock(&streamLock);
+	--streamInFlight;
+	pthread_cond_signal(&streamDrained);
+	pthread_mutex_unlock(&streamLock);
+}
+
+/* Reads the paths one at a time and hands each one over as soon as it is
+ * complete, so the files are handled while the list is still coming in, and
+ * only the paths that wait for a worker are kept in memory */
+static void commentStream(POOL *pool, WALK *walk, const char *filesFrom, int delimiter) {
+	FILE *input = (strcmp("-", filesFrom) == 0) ? stdin : fopen(filesFrom, "r");
+	if (!input) {
+		fprintf(stderr, "Could not open file list '%s': %s\n", filesFrom, strerror(errno));
+		recordResult(2);
+		return;
+	}
+
+	char *line = NULL;
+	size_t capacity = 0;
+	ssize_t length;
+	while ((length = getdelim(&line, &capacity, delimiter, input)) >= 0) {
+		if (length > 0 && line[length - 1] == delimiter) line[--length] = '\0';
+		if (length == 0) continue;
+
+		struct stat st;
+		if (walk && stat(line, &st) == 0 && S_ISDIR(st.st_mode)) {
+			walkAdd(walk, line);
+			continue;
+		}
+
+		if (!pool) {
+			recordResult(comment(line, 0, NULL));
+			continue;
+		}
+
+		if (!streamJobs) streamJobs = jobsCreate();
+		JOB *job = streamJobs ? jobsAdd(streamJobs, line, length) : NULL;
+		if (!job) {
+			fprintf(stderr, "Out of memory while reading file list '%s'\n", filesFrom);
+			recordResult(2);
 			break;
 		}
+
+		pthread_mutex_lock(&streamLock);
+		while (streamInFlight >= STREAM_AHEAD) {
+			pthread_cond_wait(&streamDrained, &streamLock);
+		}
+		++streamInFlight;
+		pthread_mutex_unlock(&streamLock);
+
+		poolSubmit(pool, commentStreamed, job);
+	}
+
+	if (ferror(input)) {
+		fprintf(stderr, "Could not read file list '%s'\n", filesFrom);
+		recordResult(2);
 	}
 
-	fclose(f);
+	free(line);
+	if (input != stdin) fclose(input);
 }
 
-static char GLOBAL_CONFIG_FILENAME[1024];
-static const char * const LOCAL_CONFIG_FILENAME = "./.comment-data";
+static int commentTree(POOL *pool, int count, char **filenames, const char *filesFrom, int delimiter) {
+	WALK *walk = walkCreate(pool, commentDiscovered, NULL);
+	if (!walk) {
+		fprintf(stderr, "Could not start walking directories\n");
+		return 2;
+	}
 
-static void prepareConfig() {
-	strcpy(GLOBAL_CONFIG_FILENAME, getenv("HOME"));
-	strcat(GLOBAL_CONFIG_FILENAME, "/.config/comment-data");
+	for (int i = 0; i < count; ++i) {
+		struct stat st;
+		if (stat(filenames[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+			walkAdd(walk, filenames[i]);
+		}
+		else {
+			poolSubmit(pool, commentTask, filenames[i]);
+		}
+	}
+
+	if (filesFrom) commentStream(pool, walk, filesFrom, delimiter);
+
+	poolWait(pool);
+	if (walkErrors(walk) > 0) recordResult(1);
+	walkDestroy(walk);
+
+	return retcode;
 }
 
-static void readConfig(int globalOnly) {
-	prepareConfig();
+static int commentAll(int count, char **filenames, int jobs, int recursive, const char *filesFrom, int delimiter) {
+	/* A file list can be any length, so it gets all the workers asked for */
+	if (!recursive && !filesFrom && jobs > count) jobs = count;
 
-	cuserid(author);
-	authorIsGlobal = 0;
-	authorIsDefault = 1;
+	/* The cache already keeps most files from being opened at all */
+	URING *ring = NULL;
+	if (!recursive && config.uringEnabled && (!config.cacheEnabled || checkOnly) && count >= URING_MIN_FILES) {
+		ring = uringCreate();
+	}
 
-	strcpy(dateformat, "%F");
-	dateformatIsGlobal = 0;
-	dateformatIsDefault = 1;
+	if (!recursive && jobs <= 1) {
+		if (!ring || commentBatched(NULL, ring, count, filenames) != 0) {
+			for (int i = 0; i < count; ++i) {
+				recordResult(comment(filenames[i], 0, NULL));
+			}
+		}
+		if (filesFrom) commentStream(NULL, NULL, filesFrom, delimiter);
+		uringDestroy(ring);
+		reportSkipped(skippedSoFar(context));
+		return retcode;
+	}
 
-	readConfigFile((const char *)GLOBAL_CONFIG_FILENAME, 1);
+	POOL *pool = poolCreate(jobs);
+	if (!pool) {
+		uringDestroy(ring);
+		fprintf(stderr, "Could not create worker pool\n");
+		return 2;
+	}
 
-	if (!globalOnly) {
-		readConfigFile(LOCAL_CONFIG_FILENAME, 0);
+	if (recursive) {
+		commentTree(pool, count, filenames, filesFrom, delimiter);
 	}
+	else {
+		if (!ring || commentBatched(pool, ring, count, filenames) != 0) {
+			for (int i = 0; i < count; ++i) {
+				poolSubmit(pool, commentTask, filenames[i]);
+			}
+		}
+		if (filesFrom) commentStream(pool, NULL, filesFrom, delimiter);
+		poolWait(pool);
+	}
+
+	poolDestroy(pool);
+	uringDestroy(ring);
+	jobsDestroy(streamJobs);
+	streamJobs = NULL;
+	reportSkipped(skippedSoFar(context));
+
+	return retcode;
 }
 
 static int setConfigFileValue(const char *filename, const char *setting, const char *value) {
@@ -182,18 +745,28 @@ static int setConfigFileValue(const char *filename, const char *setting, const c
 }
 
 static int setConfigValue(int global, const char *setting, const char *value) {
-	prepareConfig();
+	char filename[1024];
+	if (comment_config_filename(global, filename, sizeof(filename)) != 0) {
+		fprintf(stderr, "Could not find the config file, is HOME set?\n");
+		return 2;
+	}
 
-	return setConfigFileValue((global ? ((const char *)GLOBAL_CONFIG_FILENAME) : LOCAL_CONFIG_FILENAME), setting, value);
+	return setConfigFileValue(filename, setting, value);
 }
 
 static int showConfig(int global) {
-	readConfig(global);
-
-	fprintf(stdout, "author: '%s' (%s)\n", author,
-		(authorIsDefault ? "default" : (authorIsGlobal ? "global" : "local")));
-	fprintf(stdout, "dateformat: '%s' (%s)\n", dateformat,
-		(dateformatIsDefault ? "default" : (dateformatIsGlobal ? "global" : "local")));
+	comment_config_load(&config, global);
+
+	fprintf(stdout, "author: '%s' (%s)\n", config.author,
+		(config.authorIsDefault ? "default" : (config.authorIsGlobal ? "global" : "local")));
+	fprintf(stdout, "dateformat: '%s' (%s)\n", config.dateformat,
+		(config.dateformatIsDefault ? "default" : (config.dateformatIsGlobal ? "global" : "local")));
+	fprintf(stdout, "headerwindow: '%lld' (%s)\n", (long long)config.headerwindow,
+		(config.headerwindowIsDefault ? "default" : (config.headerwindowIsGlobal ? "global" : "local")));
+	fprintf(stdout, "cache: '%s' (%s)\n", (config.cacheEnabled ? "on" : "off"),
+		(config.cacheIsDefault ? "default" : (config.cacheIsGlobal ? "global" : "local")));
+	fprintf(stdout, "uring: '%s' (%s)\n", (config.uringEnabled ? "on" : "off"),
+		(config.uringIsDefault ? "default" : (config.uringIsGlobal ? "global" : "local")));
 	return 0;
 }
 
@@ -216,93 +789,3 @@ static int setConfig(int argc, const char **args) {
 		return showConfig(global);
 	}
 }
-
-static int analyzeAndComment(COMMENT *data) {
-	if (strcmp("makefile", data->localname) == 0 ||
-				strcmp("Makefile", data->localname) == 0 ||
-				strcmp(".mk", data->extension) == 0) {
-		return commentMakefile(data);
-	}
-	else if (strcmp(".c", data->extension) == 0 ||
-				strcmp(".h", data->extension) == 0 ||
-				strcmp(".cc", data->extension) == 0 ||
-				strcmp(".cpp", data->extension) == 0 ||
-				strcmp(".c++", data->extension) == 0 ||
-				strcmp(".cxx", data->extension) == 0 ||
-				strcmp(".hh", data->extension) == 0 ||
-				strcmp(".hpp", data->extension) == 0 ||
-				strcmp(".h++", data->extension) == 0) {
-		return commentC(data);
-	}
-	else if(strcmp(".tex", data->extension) == 0) {
-		return commentTex(data);
-	}
-	else if(strcmp(".sh", data->extension) == 0) {
-		return commentSh(data);
-	}
-	else {
-		char firstline[1024];
-		FILE *f = fopen(data->filename, "r");
-		if (f) {
-			if (fgets(firstline, 1024, f) == NULL) {
-				firstline[0] = '\0';
-			}
-			else {
-				if (firstline[strlen(firstline) - 1] == '\n') firstline[strlen(firstline) - 1] = '\0';
-			}
-			fclose(f);
-		}
-		else {
-			firstline[0] = '\0';
-		}
-
-		if (strncmp("#!", firstline, 2) == 0) {
-			return commentSh(data);
-		}
-		else {
-			fprintf(stderr, "Cannot add comment to: '%s'\nDon't know what type of file it is.\n", data->filename);
-			return 1;
-		}
-	}
-}
-
-static int comment(const char *filename) {
-	if (filename == NULL) {
-		return 0;
-	}
-
-	char *lastSlash = strrchr(filename, '/');
-	const char *local;
-	if (lastSlash == NULL) {
-		local = filename;
-	} else {
-		local = lastSlash + 1;
-	}
-
-	COMMENT data;
-	strcpy(data.filename, filename);
-	strcpy(data.localname, local);
-	strcpy(data.author, author);
-	stat(filename, &data.stat);
-	if (strftime(data.datetext, 256, dateformat, localtime(&data.stat.st_mtime)) == 0) {
-		fprintf(stderr, "Could not format date correctly! Please run comment --config dateformat \"FORMAT\"\n");
-		return 2;
-	}
-
-	char *lastDot = strrchr(filename, '.');
-	if (lastDot == NULL) {
-		data.extension[0] = '\0';
-	}
-	else {
-		int localIndex = (int)(local - filename);
-		int dotIndex = (int)(lastDot - filename);
-		if (localIndex > dotIndex) {
-			data.extension[0] = '\0';
-		} else {
-			strcpy(data.extension, lastDot);
-		}
-	}
-
-	return analyzeAndComment(&data);
-}
-
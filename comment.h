@@ -1,23 +1,41 @@
 /**
  * @file comment.h
  * @author Anders Tornblad
- * @date 2017-08-24
+ * @date 2026-10-18
  */
 #ifndef COMMENT_H
 #define COMMENT_H
 
+#include <sys/types.h>
 #include <sys/stat.h>
+#include "comment_io.h"
+#include "libcomment.h"
 
+/* Everything a handler needs to know about one file. The names point into
+ * the path, the author into the context's configuration and the date into
+ * the context's interned dates, so none of them are copied per file. */
 struct comment_data {
-	char filename[1024];
-	char localname[256];
-	char extension[32];
+	const char *filename;
+	const char *localname;
+	const char *extension;
+	const char *author;
+	const char *datetext;
 	struct stat stat;
-	char datetext[256];
-	char author[256];
+	VIEW view;
+	off_t headerWindow;
+	int discovered;
+	int checkOnly;
+	int skipped;
+	int stale;
+	/* When set, the stamped file goes here and nothing is written to disk */
+	COMMENT_BUFFER *output;
 };
 
 typedef struct comment_data COMMENT;
 
+/* comment_file() for callers that found the file by walking a directory, or
+ * already have it open. The view is closed before this returns. */
+int commentPath(COMMENT_CONTEXT *context, const char *filename, int discovered, VIEW *view, const struct stat *st);
+
 #endif
 
@@ -1,23 +1,27 @@
 /**
  * @file comment_c.c
  * @author Anders Tornblad
- * @date 2017-08-30
+ * @date 2026-10-18
  */
-#define _XOPEN_SOURCE
-#define _XOPEN_SOURCE_EXTENDED
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
-#include <utime.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include "comment_c.h"
+#include "comment_io.h"
+#include "comment_stats.h"
+
+#if defined(__x86_64__) && !defined(COMMENT_NO_SIMD)
+#include <immintrin.h>
+#endif
 
 static int addNewCComment(COMMENT *data);
-static int modifyCComment(COMMENT *data, int indexOfDate, int indexOfDateEnd);
+static int modifyCComment(COMMENT *data, off_t indexOfDate, off_t indexOfDateEnd);
 
 /* BETTER SOLUTION:
  * This could be done much simpler by checking line by line:
@@ -49,73 +53,188 @@ static int modifyCComment(COMMENT *data, int indexOfDate, int indexOfDateEnd);
  * If (11) hasn't happened after a full scan, there is no date comment in the file
  */
 
-int commentC(COMMENT *data) {
-	FILE *f = fopen(data->filename, "r");
-	if (!f) {
-		fprintf(stderr, "Could not open file '%s'\n", data->filename);
-		return 1;
-	}
+/* Most bytes of a source file can't change the state of the scanner. In the
+ * states that only react to a few characters (0, 3, 10 and 12), the scanner
+ * skips straight to the next candidate byte, 16 or 32 bytes at a time, and
+ * only runs the state machine on that byte. findAnyScalar() is the fallback
+ * when SSE2/AVX2 isn't available, or when built with -DCOMMENT_NO_SIMD.
+ */
 
-	int state = 0;
-	int index = 0;
-	int indexOfDate = -1;
-	int indexOfDateEnd = -1;
-	int ch;
+typedef const char *(*FIND_ANY)(const char *p, const char *end, char a, char b, char c);
 
-	while (state != 11 && (ch = fgetc(f)) != EOF) {
-		int newState = state;
+static const char *findAnyScalar(const char *p, const char *end, char a, char b, char c) {
+	while (p < end && *p != a && *p != b && *p != c) ++p;
+	return p;
+}
 
-		if (state == 0 && ch == '/') newState = 1;
+#if defined(__x86_64__) && !defined(COMMENT_NO_SIMD)
 
-		else if (state == 1 && ch == '*') newState = 2;
-		else if (state == 1) {ungetc(ch,f); newState = 0;}
+static const char *findAnySse2(const char *p, const char *end, char a, char b, char c) {
+	__m128i va = _mm_set1_epi8(a);
+	__m128i vb = _mm_set1_epi8(b);
+	__m128i vc = _mm_set1_epi8(c);
 
-		else if (state == 2 && ch == '*') newState = 3;
-		else if (state == 2) {ungetc(ch,f); newState = 12;}
+	while (end - p >= 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)p);
+		__m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb)),
+				_mm_cmpeq_epi8(chunk, vc));
+		int mask = _mm_movemask_epi8(hits);
+		if (mask) return p + __builtin_ctz(mask);
+		p += 16;
+	}
 
-		else if (state == 3 && ch == '@') newState = 5;
-		else if (state == 3 && ch == '*') newState = 4;
+	return findAnyScalar(p, end, a, b, c);
+}
 
-		else if (state == 4 && ch == '/') newState = 0;
-		else if (state == 4) {ungetc(ch,f); newState = 3;}
+__attribute__((target("avx2")))
+static const char *findAnyAvx2(const char *p, const char *end, char a, char b, char c) {
+	__m256i va = _mm256_set1_epi8(a);
+	__m256i vb = _mm256_set1_epi8(b);
+	__m256i vc = _mm256_set1_epi8(c);
+
+	while (end - p >= 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+		__m256i hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, va), _mm256_cmpeq_epi8(chunk, vb)),
+				_mm256_cmpeq_epi8(chunk, vc));
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(hits);
+		if (mask) return p + __builtin_ctz(mask);
+		p += 32;
+	}
 
-		else if (state == 5 && ch == 'd') newState = 6;
-		else if (state == 5) {ungetc(ch,f); newState = 3;}
+	return findAnySse2(p, end, a, b, c);
+}
 
-		else if (state == 6 && ch == 'a') newState = 7;
-		else if (state == 6) {ungetc(ch,f); newState = 3;}
+static FIND_ANY selectFindAny(void) {
+	if (__builtin_cpu_supports("avx2")) return findAnyAvx2;
+	return findAnySse2;
+}
 
-		else if (state == 7 && ch == 't') newState = 8;
-		else if (state == 7) {ungetc(ch,f); newState = 3;}
+#else
 
-		else if (state == 8 && ch == 'e') newState = 9;
-		else if (state == 8) {ungetc(ch,f); newState = 3;}
+static FIND_ANY selectFindAny(void) {
+	return findAnyScalar;
+}
 
-		else if (state == 9 && ch == '\n') newState = 11;
-		else if (state == 9 && ch != ' ' && ch != '\t') newState = 10;
+#endif
 
-		else if (state == 10 && ch == '\n') newState = 11;
+/* Runs the state machine over the buffer, using the position in the buffer
+ * instead of ftell(). Where the stream version did ungetc(), the pointer is
+ * simply not advanced, so the same character is looked at again in the new state.
+ * With headerOnly set, the scan gives up at the first thing outside the state
+ * machine's comments that isn't whitespace or a // comment, because a file
+ * header can't come after actual code.
+ */
+void scanC(const char *start, const char *end, int headerOnly, off_t *indexOfDate, off_t *indexOfDateEnd) {
+	FIND_ANY findAny = selectFindAny();
+	const char *p = start;
+	int state = 0;
 
-		else if (state == 12 && ch == '*') newState = 13;
+	*indexOfDate = -1;
+	*indexOfDateEnd = -1;
+
+	while (state != 11 && p < end) {
+		if (state == 0 && headerOnly) {
+			while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == '\f' || *p == '\v')) ++p;
+			if (p == end || *p != '/') break;
+			if (p + 1 < end && p[1] == '/') {
+				const char *newline = memchr(p, '\n', end - p);
+				p = newline ? newline : end;
+				continue;
+			}
+		}
+		else if (state == 0) p = findAny(p, end, '/', '/', '/');
+		else if (state == 3) p = findAny(p, end, '@', '*', '*');
+		else if (state == 12) p = findAny(p, end, '*', '*', '*');
+		else if (state == 10) {
+			const char *newline = memchr(p, '\n', end - p);
+			p = newline ? newline : end;
+		}
+		if (p == end) break;
 
-		else if (state == 13 && ch == '/') newState = 0;
-		else if (state == 13 && ch == '*') newState = 13;
-		else if (state == 13) newState = 12;
+		char ch = *p;
+		int newState = state;
+		int consume = 1;
+
+		switch (state) {
+			case 0:
+				if (ch == '/') newState = 1;
+				break;
+			case 1:
+				if (ch == '*') newState = 2;
+				else {consume = 0; newState = 0;}
+				break;
+			case 2:
+				if (ch == '*') newState = 3;
+				else {consume = 0; newState = 12;}
+				break;
+			case 3:
+				if (ch == '@') newState = 5;
+				else if (ch == '*') newState = 4;
+				break;
+			case 4:
+				if (ch == '/') newState = 0;
+				else {consume = 0; newState = 3;}
+				break;
+			case 5:
+				if (ch == 'd') newState = 6;
+				else {consume = 0; newState = 3;}
+				break;
+			case 6:
+				if (ch == 'a') newState = 7;
+				else {consume = 0; newState = 3;}
+				break;
+			case 7:
+				if (ch == 't') newState = 8;
+				else {consume = 0; newState = 3;}
+				break;
+			case 8:
+				if (ch == 'e') newState = 9;
+				else {consume = 0; newState = 3;}
+				break;
+			case 9:
+				if (ch == '\n') newState = 11;
+				else if (ch != ' ' && ch != '\t') newState = 10;
+				break;
+			case 10:
+				if (ch == '\n') newState = 11;
+				break;
+			case 12:
+				if (ch == '*') newState = 13;
+				break;
+			case 13:
+				if (ch == '/') newState = 0;
+				else if (ch != '*') newState = 12;
+				break;
+		}
 
 		if (state != newState) {
 			if (newState == 10) {
-				indexOfDate = index;
+				*indexOfDate = p - start;
 			}
 			else if (newState == 11) {
-				indexOfDateEnd = index;
+				*indexOfDateEnd = p - start;
 			}
 		}
 
 		state = newState;
-		index = ftell(f);
+		if (consume) ++p;
 	}
+}
 
-	fclose(f);
+int commentC(COMMENT *data) {
+	VIEW *view = &data->view;
+	if (!VIEW_IS_OPEN(view) || viewExtend(view, data->headerWindow) != 0) {
+		fprintf(stderr, "Could not open file '%s'\n", data->filename);
+		return 1;
+	}
+
+	off_t indexOfDate;
+	off_t indexOfDateEnd;
+	size_t length = view->length;
+	if (data->headerWindow > 0 && (size_t)data->headerWindow < length) length = data->headerWindow;
+	statsEnter(STATS_SCAN);
+	scanC(view->data, view->data + length, data->headerWindow > 0, &indexOfDate, &indexOfDateEnd);
+	statsLeave();
 
 	if (indexOfDateEnd == -1) {
 		return addNewCComment(data);
@@ -127,147 +246,118 @@ int commentC(COMMENT *data) {
 }
 
 static int addNewCComment(COMMENT *data) {
+	if (data->checkOnly) {
+		data->stale = 1;
+		return 0;
+	}
+
+	char header[2048];
+	int headerLength = snprintf(header, sizeof(header),
+		"/" "**\n"
+		" * @file %s\n"
+		" * @author %s\n"
+		" * @date %s\n"
+		" */\n",
+		data->localname, data->author, data->datetext);
+
+	/* The header goes out with the first part of the file, the rest is copied by the kernel */
+	struct iovec parts[2];
+	parts[0].iov_base = header;
+	parts[0].iov_len = headerLength;
+
+	if (data->output) {
+		if (bufferPartsAndRest(data->output, parts, 1, &data->view, 0) != 0) {
+			fprintf(stderr, "Out of memory while adding a comment to '%s'\n", data->filename);
+			return 2;
+		}
+		statsCount(STATS_ADDED, 1);
+		return 0;
+	}
+
 	/* Create a new temp file, containing a new doxygen comment, and the full source file */
-	char tempname[512];
-	sprintf(tempname, "/tmp/comment-%s-XXXXXX", data->localname);
-	int tempfd = mkstemp(tempname);
-	if (tempfd < 1) {
+	REPLACEMENT replace;
+	if (!beginReplace(data->filename, &replace)) {
 		fprintf(stderr, "Could not create temporary file: %s\n", strerror(errno));
 		return 2;
 	}
 
-	unlink(tempname);
-	FILE *temp = fdopen(tempfd, "w+");
-	if (!temp) {
-		fprintf(stderr, "Could not create temporary file\n");
-		return 2;
-	}
-	fprintf(temp, "/" "**\n");
-	fprintf(temp, " * @file %s\n", data->localname);
-	fprintf(temp, " * @author %s\n", data->author);
-	fprintf(temp, " * @date %s\n", data->datetext);
-	fprintf(temp, " */\n");
-	FILE *input = fopen(data->filename, "r");
-	if (!input) {
-		fprintf(stderr, "When copying existing parts of original file, adding a new C comment,\n"
-				"the original file could not be opened: %s\n", strerror(errno));
-		fflush(temp);
-		fclose(temp);
-		close(tempfd);
+	if (writePartsAndRest(replace.fd, parts, 1, &data->view, 0) != 0) {
+		fprintf(stderr, "Could not write temporary file for '%s': %s\n", data->filename, strerror(errno));
+		abortReplace(&replace);
 		return 2;
 	}
 
-	int ch;
-	while ((ch = fgetc(input)) != EOF) {
-		fputc(ch, temp);
-	}
-	fclose(input);
-	fflush(temp);
-
-	/* Copy the temp file to the original filename */
-	fseek(temp, 0, SEEK_SET);
-	FILE *output = fopen(data->filename, "w");
-	if (!output) {
-		fprintf(stderr, "When copying temporary file over the original file, adding a new\n"
+	/* Swap the temp file in for the original, keeping its mode, owner and times */
+	if (commitReplace(&replace, &data->stat) != 0) {
+		fprintf(stderr, "When moving temporary file over the original file, adding a new\n"
 				"C comment, the original file could not be overwritten: %s\n", strerror(errno));
-		fclose(temp);
-		close(tempfd);
 		return 2;
 	}
 
-	while ((ch = fgetc(temp)) != EOF) {
-		fputc(ch, output);
-	}
-	fflush(output);
-	fclose(output);
-	fclose(temp);
-	close(tempfd);
-
-	/* Touch the file! */
-	struct utimbuf utb;
-	utb.actime = data->stat.st_atime;
-	utb.modtime = data->stat.st_mtime;
-	utime(data->filename, &utb);
-
+	statsCount(STATS_ADDED, 1);
 	return 0;
 }
 
-static int modifyCComment(COMMENT *data, int indexOfDate, int indexOfDateEnd) {
-	/* Create a new temp file */
-	char tempname[512];
-	sprintf(tempname, "/tmp/comment-%s-XXXXXX", data->localname);
-	int tempfd = mkstemp(tempname);
-	if (tempfd < 1) {
-		fprintf(stderr, "Could not create temporary file: %s\n", strerror(errno));
-		return 2;
-	}
+static int modifyCComment(COMMENT *data, off_t indexOfDate, off_t indexOfDateEnd) {
+	const VIEW *view = &data->view;
+	size_t dateLength = strlen(data->datetext);
 
-	unlink(tempname);
-	FILE *temp = fdopen(tempfd, "w+");
-	if (!temp) {
-		fprintf(stderr, "Could not create temporary file\n");
-		return 2;
-	}
+	int sameLength = (indexOfDateEnd - indexOfDate == (off_t)dateLength);
 
-	FILE *input = fopen(data->filename, "r");
-	if (!input) {
-		fprintf(stderr, "When copying existing parts of original file, modifying a C comment,\n"
-				"the original file could not be opened: %s\n", strerror(errno));
-		fflush(temp);
-		fclose(temp);
-		close(tempfd);
-		return 2;
+	/* Nothing to write if the file already has the current date */
+	if (sameLength && memcmp(&view->data[indexOfDate], data->datetext, dateLength) == 0) {
+		data->skipped = 1;
+		return 0;
 	}
 
-	int ch;
-	int index = 0;
-	/* Copy everything until existing date */
-	while (index < indexOfDate) {
-		ch = fgetc(input);
-		fputc(ch, temp);
-		index = ftell(input);
+	/* In check mode, a date that would be rewritten is just reported */
+	if (data->checkOnly) {
+		data->stale = 1;
+		return 0;
 	}
-	/* Copy date text */
-	const char *date = &data->datetext[0];
-	while (*date) {
-		fputc(*date, temp);
-		++date;
-	}
-	/* Skip existing date */
-	while (index < indexOfDateEnd) {
-		ch = fgetc(input);
-		index = ftell(input);
+
+	/* Just as long as the old date, so overwrite it in place */
+	if (sameLength && !data->output && patchFile(data->filename, indexOfDate, data->datetext, dateLength, &data->stat) == 0) {
+		statsCount(STATS_MODIFIED, 1);
+		return 0;
 	}
-	/* Copy everything after */
-	while ((ch = fgetc(input)) != EOF) {
-		fputc(ch, temp);
+
+	/* Everything until the existing date, the new date, and everything after the old date */
+	struct iovec parts[3];
+	parts[0].iov_base = (void *)view->data;
+	parts[0].iov_len = indexOfDate;
+	parts[1].iov_base = (void *)data->datetext;
+	parts[1].iov_len = dateLength;
+
+	if (data->output) {
+		if (bufferPartsAndRest(data->output, parts, 2, view, indexOfDateEnd) != 0) {
+			fprintf(stderr, "Out of memory while modifying the comment in '%s'\n", data->filename);
+			return 2;
+		}
+		statsCount(STATS_MODIFIED, 1);
+		return 0;
 	}
-	fflush(temp);
-	fclose(input);
-
-	/* Copy the temp file to the original filename */
-	fseek(temp, 0, SEEK_SET);
-	FILE *output = fopen(data->filename, "w");
-	if (!output) {
-		fprintf(stderr, "When copying temporary file over the original file, modifying a\n"
-				"C comment, the original file could not be overwritten: %s\n", strerror(errno));
-		fclose(temp);
-		close(tempfd);
+
+	/* Create a new temp file */
+	REPLACEMENT replace;
+	if (!beginReplace(data->filename, &replace)) {
+		fprintf(stderr, "Could not create temporary file: %s\n", strerror(errno));
 		return 2;
 	}
 
-	while ((ch = fgetc(temp)) != EOF) {
-		fputc(ch, output);
+	if (writePartsAndRest(replace.fd, parts, 2, view, indexOfDateEnd) != 0) {
+		fprintf(stderr, "Could not write temporary file for '%s': %s\n", data->filename, strerror(errno));
+		abortReplace(&replace);
+		return 2;
 	}
-	fflush(output);
-	fclose(output);
-	fclose(temp);
 
-	/* Touch the file */
-	struct utimbuf utb;
-	utb.actime = data->stat.st_atime;
-	utb.modtime = data->stat.st_mtime;
-	utime(data->filename, &utb);
+	/* Swap the temp file in for the original, keeping its mode, owner and times */
+	if (commitReplace(&replace, &data->stat) != 0) {
+		fprintf(stderr, "When moving temporary file over the original file, modifying a\n"
+				"C comment, the original file could not be overwritten: %s\n", strerror(errno));
+		return 2;
+	}
 
+	statsCount(STATS_MODIFIED, 1);
 	return 0;
 }
@@ -1,7 +1,7 @@
 /**
  * @file comment_c.h
  * @author Anders Tornblad
- * @date 2017-08-24
+ * @date 2026-10-18
  */
 #ifndef COMMENT_C_H
 #define COMMENT_C_H
@@ -9,6 +9,7 @@
 #include "comment.h"
 
 int commentC(COMMENT *data);
+void scanC(const char *start, const char *end, int headerOnly, off_t *indexOfDate, off_t *indexOfDateEnd);
 
 #endif
 
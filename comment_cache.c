@@ -0,0 +1,423 @@
+/**
+ * @file comment_cache.c
+ * @brief incremental cache of files that already have a current date
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "comment_cache.h"
+#include "comment_io.h"
+
+/* FILE FORMAT
+ * A header with a magic string, a format version and a fingerprint of the
+ * configuration (author, dateformat, ...) that the dates were stamped with,
+ * followed by records:
+ *   dev, ino, size, mtime in nanoseconds, path length, path bytes
+ * Every record starts at a multiple of 8 bytes, so the file can be used
+ * directly through mmap. New records are only ever appended, and a later
+ * record for the same path replaces an earlier one. When more than half of
+ * the records are stale, the whole file is rewritten the first time new
+ * records are written out.
+ *
+ * New records go straight into the index, so a process that runs for long,
+ * watching or serving, knows about the files it stamped itself. They are
+ * kept in blocks that never move, and the index points into those just like
+ * it points into the mapping. They are written out once CACHE_FLUSH_SIZE
+ * bytes of them have piled up, or CACHE_FLUSH_SECONDS after the last time,
+ * and when the cache is closed, so they aren't all lost if the process is
+ * killed.
+ */
+
+#define CACHE_MAGIC "CMTCACHE"
+#define CACHE_VERSION 1
+#define CACHE_FLUSH_SIZE 65536
+#define CACHE_FLUSH_SECONDS 5
+#define CACHE_BLOCK_SIZE 65536
+
+struct cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t fingerprint;
+};
+
+struct cache_record {
+	uint64_t dev;
+	uint64_t ino;
+	int64_t size;
+	int64_t mtime;
+	uint32_t pathLength;
+	uint32_t reserved;
+};
+
+struct record_block {
+	struct record_block *next;
+	size_t length;
+	size_t capacity;
+	char data[];
+};
+
+struct cache_entry {
+	const struct cache_record *record;
+	const char *path;
+	uint64_t hash;
+};
+
+struct comment_cache {
+	char *filename;
+	unsigned int fingerprint;
+	MAPPING map;
+	struct cache_entry *entries;
+	size_t capacity;
+	size_t count;
+	size_t records;
+	int rewrite;
+	pthread_mutex_t lock;
+	struct record_block *blocks;
+	struct record_block *lastBlock;
+	struct record_block *unwritten;
+	size_t unwrittenFrom;
+	size_t pendingLength;
+	time_t lastFlush;
+	int failed;
+};
+
+static size_t recordSize(uint32_t pathLength) {
+	return (sizeof(struct cache_record) + pathLength + 7) & ~(size_t)7;
+}
+
+static uint64_t hashPath(const char *path, size_t length) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < length; ++i) {
+		hash ^= (unsigned char)path[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static int64_t mtimeOf(const struct stat *st) {
+	return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static struct cache_entry *findEntry(CACHE *cache, const char *path, size_t length, uint64_t hash) {
+	size_t slot = hash & (cache->capacity - 1);
+	while (cache->entries[slot].record) {
+		struct cache_entry *entry = &cache->entries[slot];
+		if (entry->hash == hash && entry->record->pathLength == length && memcmp(entry->path, path, length) == 0) {
+			return entry;
+		}
+		slot = (slot + 1) & (cache->capacity - 1);
+	}
+	return &cache->entries[slot];
+}
+
+static void indexRecord(CACHE *cache, const struct cache_record *record, const char *path) {
+	uint64_t hash = hashPath(path, record->pathLength);
+	struct cache_entry *entry = findEntry(cache, path, record->pathLength, hash);
+	if (!entry->record) ++cache->count;
+	entry->record = record;
+	entry->path = path;
+	entry->hash = hash;
+	++cache->records;
+}
+
+/* Keeps the index at most half full, if there is memory */
+static void growEntries(CACHE *cache) {
+	size_t capacity = cache->capacity * 2;
+	struct cache_entry *entries = calloc(capacity, sizeof(struct cache_entry));
+	if (!entries) return;
+
+	for (size_t i = 0; i < cache->capacity; ++i) {
+		if (!cache->entries[i].record) continue;
+		size_t slot = cache->entries[i].hash & (capacity - 1);
+		while (entries[slot].record) slot = (slot + 1) & (capacity - 1);
+		entries[slot] = cache->entries[i];
+	}
+
+	free(cache->entries);
+	cache->entries = entries;
+	cache->capacity = capacity;
+}
+
+static int loadRecords(CACHE *cache) {
+	const char *p = cache->map.data + sizeof(struct cache_header);
+	const char *end = cache->map.data + cache->map.length;
+
+	size_t capacity = 1024;
+	while (capacity < (cache->map.length / sizeof(struct cache_record)) * 2) capacity *= 2;
+	cache->entries = calloc(capacity, sizeof(struct cache_entry));
+	if (!cache->entries) return -1;
+	cache->capacity = capacity;
+
+	while (end - p >= (ptrdiff_t)sizeof(struct cache_record)) {
+		const struct cache_record *record = (const struct cache_record *)p;
+		size_t size = recordSize(record->pathLength);
+		if ((size_t)(end - p) < size) break;
+
+		indexRecord(cache, record, p + sizeof(struct cache_record));
+		p += size;
+	}
+
+	/* A record cut short by a crash is dropped by rewriting the file */
+	if (p != end) cache->rewrite = 1;
+	return 0;
+}
+
+CACHE *cacheOpen(const char *filename, unsigned int fingerprint) {
+	CACHE *cache = calloc(1, sizeof(CACHE));
+	if (!cache) return NULL;
+
+	cache->filename = strdup(filename);
+	cache->fingerprint = fingerprint;
+	pthread_mutex_init(&cache->lock, NULL);
+
+	int usable = 0;
+	if (mapFile(filename, 0, &cache->map) == 0 && cache->map.length >= sizeof(struct cache_header)) {
+		const struct cache_header *header = (const struct cache_header *)cache->map.data;
+		usable = memcmp(header->magic, CACHE_MAGIC, 8) == 0 &&
+			header->version == CACHE_VERSION &&
+			header->fingerprint == fingerprint;
+	}
+
+	if (!usable) {
+		/* Missing, damaged or stamped with other settings - start over */
+		unmapFile(&cache->map);
+		cache->rewrite = 1;
+		cache->capacity = 1024;
+		cache->entries = calloc(cache->capacity, sizeof(struct cache_entry));
+	}
+	else if (loadRecords(cache) != 0) {
+		cache->entries = NULL;
+	}
+	if (cache->records > cache->count * 2) cache->rewrite = 1;
+	cache->lastFlush = time(NULL);
+
+	if (!cache->filename || !cache->entries) {
+		unmapFile(&cache->map);
+		free(cache->entries);
+		free(cache->filename);
+		free(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+static int flushPending(CACHE *cache);
+
+/* Only call with the lock held */
+static int isCurrent(CACHE *cache, const char *path, const struct stat *st) {
+	size_t length = strlen(path);
+	struct cache_entry *entry = findEntry(cache, path, length, hashPath(path, length));
+	if (!entry->record) return 0;
+
+	return entry->record->dev == (uint64_t)st->st_dev &&
+		entry->record->ino == (uint64_t)st->st_ino &&
+		entry->record->size == (int64_t)st->st_size &&
+		entry->record->mtime == mtimeOf(st);
+}
+
+/* Only call with the lock held. Records that have waited long enough are
+ * written out, even if no new ones come along to push them. */
+static void flushIfDue(CACHE *cache) {
+	if (cache->pendingLength == 0) return;
+	if (cache->pendingLength >= CACHE_FLUSH_SIZE || time(NULL) - cache->lastFlush >= CACHE_FLUSH_SECONDS) {
+		flushPending(cache);
+	}
+}
+
+/* Is the file unchanged since the last time it was stamped, in this run or
+ * an earlier one? */
+int cacheIsCurrent(CACHE *cache, const char *path, const struct stat *st) {
+	pthread_mutex_lock(&cache->lock);
+	int current = isCurrent(cache, path, st);
+	flushIfDue(cache);
+	pthread_mutex_unlock(&cache->lock);
+	return current;
+}
+
+/* Only call with the lock held. Returns NULL if there is no memory. */
+static char *addRecord(CACHE *cache, size_t size) {
+	struct record_block *block = cache->lastBlock;
+	if (!block || block->length + size > block->capacity) {
+		size_t capacity = (size > CACHE_BLOCK_SIZE) ? size : CACHE_BLOCK_SIZE;
+		block = malloc(sizeof(struct record_block) + capacity);
+		if (!block) return NULL;
+		block->next = NULL;
+		block->length = 0;
+		block->capacity = capacity;
+
+		if (cache->lastBlock) cache->lastBlock->next = block;
+		else cache->blocks = block;
+		cache->lastBlock = block;
+		if (!cache->unwritten) {
+			cache->unwritten = block;
+			cache->unwrittenFrom = 0;
+		}
+	}
+
+	char *p = &block->data[block->length];
+	block->length += size;
+	cache->pendingLength += size;
+	return p;
+}
+
+void cacheRecord(CACHE *cache, const char *path, const struct stat *st) {
+	struct cache_record record;
+	record.dev = st->st_dev;
+	record.ino = st->st_ino;
+	record.size = st->st_size;
+	record.mtime = mtimeOf(st);
+	record.pathLength = strlen(path);
+	record.reserved = 0;
+	size_t size = recordSize(record.pathLength);
+
+	pthread_mutex_lock(&cache->lock);
+	char *p = isCurrent(cache, path, st) ? NULL : addRecord(cache, size);
+	if (p) {
+		memset(p, 0, size);
+		memcpy(p, &record, sizeof(struct cache_record));
+		memcpy(p + sizeof(struct cache_record), path, record.pathLength);
+
+		if ((cache->count + 1) * 2 > cache->capacity) growEntries(cache);
+		if (cache->count * 2 < cache->capacity) {
+			indexRecord(cache, (const struct cache_record *)p, p + sizeof(struct cache_record));
+		}
+
+		/* Paths stamped over and over again, by a server, end up rewritten */
+		if (cache->records > cache->count * 2) cache->rewrite = 1;
+	}
+	flushIfDue(cache);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+static int writeBuffer(int fd, const char *buffer, size_t length) {
+	while (length > 0) {
+		ssize_t count = write(fd, buffer, length);
+		if (count < 0 && errno == EINTR) continue;
+		if (count < 0) return -1;
+		buffer += count;
+		length -= count;
+	}
+	return 0;
+}
+
+static int rewriteCache(CACHE *cache) {
+	size_t size = strlen(cache->filename) + 32;
+	char *tempname = malloc(size);
+	if (!tempname) return -1;
+	snprintf(tempname, size, "%s.%ld", cache->filename, (long)getpid());
+
+	int fd = open(tempname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		free(tempname);
+		return -1;
+	}
+
+	struct cache_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CACHE_MAGIC, 8);
+	header.version = CACHE_VERSION;
+	header.fingerprint = cache->fingerprint;
+
+	int result = writeBuffer(fd, (const char *)&header, sizeof(header));
+
+	/* Records are stored padded, in the mapping and in the blocks, so they
+	 * can be written as they are */
+	for (size_t i = 0; result == 0 && i < cache->capacity; ++i) {
+		const struct cache_record *record = cache->entries[i].record;
+		if (record) {
+			result = writeBuffer(fd, (const char *)record, recordSize(record->pathLength));
+		}
+	}
+
+	if (close(fd) != 0) result = -1;
+
+	if (result == 0) result = rename(tempname, cache->filename);
+	if (result != 0) unlink(tempname);
+	free(tempname);
+	return result;
+}
+
+static int appendToCache(CACHE *cache) {
+	if (cache->pendingLength == 0) return 0;
+
+	int fd = open(cache->filename, O_WRONLY | O_APPEND | O_CLOEXEC);
+	if (fd < 0) return -1;
+
+	int result = 0;
+	size_t from = cache->unwrittenFrom;
+	for (struct record_block *block = cache->unwritten; result == 0 && block; block = block->next) {
+		result = writeBuffer(fd, &block->data[from], block->length - from);
+		from = 0;
+	}
+	if (close(fd) != 0) result = -1;
+	return result;
+}
+
+/* Only call with the lock held. A file with too many stale records in it is
+ * rewritten from the index, otherwise new records are just appended. */
+static int flushPending(CACHE *cache) {
+	int result;
+	if (cache->rewrite) {
+		result = rewriteCache(cache);
+		if (result == 0) {
+			cache->rewrite = 0;
+			cache->records = cache->count;
+		}
+	}
+	else {
+		result = appendToCache(cache);
+	}
+	cache->lastFlush = time(NULL);
+
+	/* Once is enough to tell, and the run goes on without those records */
+	if (result != 0 && !cache->failed) {
+		fprintf(stderr, "Could not update cache file '%s': %s\n", cache->filename, strerror(errno));
+		cache->failed = 1;
+	}
+	cache->unwritten = cache->lastBlock;
+	cache->unwrittenFrom = cache->lastBlock ? cache->lastBlock->length : 0;
+	cache->pendingLength = 0;
+	return result;
+}
+
+/* Writes out the records added so far */
+int cacheFlush(CACHE *cache) {
+	if (!cache) return 0;
+
+	pthread_mutex_lock(&cache->lock);
+	int result = (cache->pendingLength > 0 || cache->rewrite) ? flushPending(cache) : 0;
+	pthread_mutex_unlock(&cache->lock);
+	return result;
+}
+
+/* Saves the records added during this run, and frees the cache */
+int cacheClose(CACHE *cache) {
+	if (!cache) return 0;
+
+	int result = cacheFlush(cache);
+
+	unmapFile(&cache->map);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->entries);
+	while (cache->blocks) {
+		struct record_block *next = cache->blocks->next;
+		free(cache->blocks);
+		cache->blocks = next;
+	}
+	free(cache->filename);
+	free(cache);
+
+	return result;
+}
@@ -0,0 +1,19 @@
+/**
+ * @file comment_cache.h
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#ifndef COMMENT_CACHE_H
+#define COMMENT_CACHE_H
+
+#include <sys/stat.h>
+
+typedef struct comment_cache CACHE;
+
+CACHE *cacheOpen(const char *filename, unsigned int fingerprint);
+int cacheIsCurrent(CACHE *cache, const char *path, const struct stat *st);
+void cacheRecord(CACHE *cache, const char *path, const struct stat *st);
+int cacheFlush(CACHE *cache);
+int cacheClose(CACHE *cache);
+
+#endif
@@ -0,0 +1,317 @@
+/**
+ * @file comment_date.c
+ * @brief cached, shared rendering of modification times with the configured format
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "comment_date.h"
+
+/* RENDERING
+ * The date format decides how often the text changes: %F stays the same for
+ * a whole local day, %H:%M for a minute. That unit is found once, by looking
+ * at the conversions in the format. When a time is rendered, the range of
+ * times that falls in the same unit (the same day, say) is remembered along
+ * with the text, and any other time in that range gets the same text without
+ * calling localtime_r() or strftime() again.
+ *
+ * A range is only trusted if both of its ends are in the same unit and UTC
+ * offset as the time that was rendered, so a day with a daylight saving
+ * change is simply rendered second by second. Formats with conversions that
+ * aren't known here are treated the same way. Checking the ends says nothing
+ * about what happens in between, though, so %z and %Z are kept to a day at
+ * most, which never has more than one change of UTC offset in it.
+ *
+ * Every thread first checks the last range it used, which is what nearly all
+ * files in a tree hit, and only then the ranges shared by all threads, under
+ * a lock. Texts are interned, so every file with the same date points at the
+ * same string, which lives until the DATES is destroyed. A format with
+ * seconds in it can give every file a text of its own, so the table of
+ * interned texts grows along with them.
+ */
+
+#define DATE_RANGES 64
+#define DATE_BUCKETS 256
+
+enum date_unit {
+	UNIT_SECOND,
+	UNIT_MINUTE,
+	UNIT_HOUR,
+	UNIT_DAY,
+	UNIT_MONTH,
+	UNIT_YEAR
+};
+
+struct date_range {
+	time_t start;
+	time_t end;
+	const char *text;
+};
+
+struct interned_date {
+	struct interned_date *next;
+	unsigned int hash;
+	char text[];
+};
+
+struct comment_dates {
+	char *format;
+	enum date_unit unit;
+	unsigned long id;
+	pthread_mutex_t lock;
+	struct date_range ranges[DATE_RANGES];
+	int rangeCount;
+	int nextRange;
+	struct interned_date **interned;
+	size_t bucketCount;
+	size_t internedCount;
+};
+
+/* The id keeps a thread from using a range of a DATES that is gone, even if
+ * a new one ends up at the same address */
+static unsigned long lastId;
+static __thread unsigned long recentId;
+static __thread struct date_range recent;
+
+static enum date_unit unitOf(const char *format) {
+	enum date_unit unit = UNIT_YEAR;
+
+	for (const char *p = format; *p; ++p) {
+		if (*p != '%') continue;
+
+		++p;
+		while (*p && strchr("_-0^#", *p)) ++p;
+		while (*p >= '0' && *p <= '9') ++p;
+		if (*p == 'E' || *p == 'O') ++p;
+		if (!*p) break;
+
+		enum date_unit needed;
+		switch (*p) {
+			case '%': case 'n': case 't':
+			case 'Y': case 'y': case 'C':
+				needed = UNIT_YEAR;
+				break;
+			case 'm': case 'b': case 'B': case 'h':
+				needed = UNIT_MONTH;
+				break;
+			case 'd': case 'e': case 'j': case 'a': case 'A': case 'u': case 'w':
+			case 'U': case 'W': case 'V': case 'G': case 'g': case 'D': case 'F': case 'x':
+			case 'z': case 'Z':
+				needed = UNIT_DAY;
+				break;
+			case 'H': case 'I': case 'k': case 'l': case 'p': case 'P':
+				needed = UNIT_HOUR;
+				break;
+			case 'M': case 'R':
+				needed = UNIT_MINUTE;
+				break;
+			default:
+				needed = UNIT_SECOND;
+				break;
+		}
+		if (needed < unit) unit = needed;
+	}
+
+	return unit;
+}
+
+static int sameUnit(const struct tm *a, const struct tm *b, enum date_unit unit) {
+	if (a->tm_gmtoff != b->tm_gmtoff || a->tm_isdst != b->tm_isdst) return 0;
+	if (a->tm_year != b->tm_year) return 0;
+	if (unit <= UNIT_MONTH && a->tm_mon != b->tm_mon) return 0;
+	if (unit <= UNIT_DAY && a->tm_mday != b->tm_mday) return 0;
+	if (unit <= UNIT_HOUR && a->tm_hour != b->tm_hour) return 0;
+	if (unit <= UNIT_MINUTE && a->tm_min != b->tm_min) return 0;
+	if (unit <= UNIT_SECOND && a->tm_sec != b->tm_sec) return 0;
+	return 1;
+}
+
+static int isLeapYear(const struct tm *tm) {
+	int year = tm->tm_year + 1900;
+	return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+static int daysInMonth(const struct tm *tm) {
+	static const int DAYS[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	return DAYS[tm->tm_mon] + (tm->tm_mon == 1 && isLeapYear(tm));
+}
+
+/* The times around time that render the same, or just time itself if the
+ * unit can't be trusted to be that long */
+static void rangeOf(time_t time, const struct tm *tm, enum date_unit unit, struct date_range *range) {
+	long intoDay = tm->tm_hour * 3600L + tm->tm_min * 60L + tm->tm_sec;
+	long into = 0;
+	long length = 1;
+
+	switch (unit) {
+		case UNIT_SECOND:
+			break;
+		case UNIT_MINUTE:
+			into = tm->tm_sec;
+			length = 60;
+			break;
+		case UNIT_HOUR:
+			into = tm->tm_min * 60L + tm->tm_sec;
+			length = 3600;
+			break;
+		case UNIT_DAY:
+			into = intoDay;
+			length = 86400;
+			break;
+		case UNIT_MONTH:
+			into = (tm->tm_mday - 1) * 86400L + intoDay;
+			length = daysInMonth(tm) * 86400L;
+			break;
+		case UNIT_YEAR:
+			into = tm->tm_yday * 86400L + intoDay;
+			length = (isLeapYear(tm) ? 366 : 365) * 86400L;
+			break;
+	}
+
+	range->start = time - into;
+	range->end = range->start + length;
+
+	struct tm first;
+	struct tm last;
+	time_t lastTime = range->end - 1;
+	if (length > 1 && (!localtime_r(&range->start, &first) || !localtime_r(&lastTime, &last) ||
+			!sameUnit(tm, &first, unit) || !sameUnit(tm, &last, unit))) {
+		range->start = time;
+		range->end = time + 1;
+	}
+}
+
+/* Doubles the buckets when there are twice as many texts, if there is memory */
+static void growInterned(DATES *dates) {
+	size_t bucketCount = dates->bucketCount * 2;
+	struct interned_date **interned = calloc(bucketCount, sizeof(struct interned_date *));
+	if (!interned) return;
+
+	for (size_t i = 0; i < dates->bucketCount; ++i) {
+		struct interned_date *date = dates->interned[i];
+		while (date) {
+			struct interned_date *next = date->next;
+			struct interned_date **bucket = &interned[date->hash % bucketCount];
+			date->next = *bucket;
+			*bucket = date;
+			date = next;
+		}
+	}
+
+	free(dates->interned);
+	dates->interned = interned;
+	dates->bucketCount = bucketCount;
+}
+
+static const char *intern(DATES *dates, const char *text, size_t length) {
+	unsigned int hash = 2166136261u;
+	for (size_t i = 0; i < length; ++i) {
+		hash ^= (unsigned char)text[i];
+		hash *= 16777619u;
+	}
+
+	struct interned_date **bucket = &dates->interned[hash % dates->bucketCount];
+	struct interned_date *date = *bucket;
+	while (date && (date->hash != hash || strcmp(date->text, text) != 0)) date = date->next;
+
+	if (!date) {
+		date = malloc(sizeof(struct interned_date) + length + 1);
+		if (!date) return NULL;
+		memcpy(date->text, text, length + 1);
+		date->hash = hash;
+		date->next = *bucket;
+		*bucket = date;
+		if (++dates->internedCount > dates->bucketCount * 2) growInterned(dates);
+	}
+	return date->text;
+}
+
+static const char *findRange(DATES *dates, time_t time) {
+	for (int i = 0; i < dates->rangeCount; ++i) {
+		const struct date_range *range = &dates->ranges[i];
+		if (range->start <= time && time < range->end) {
+			recent = *range;
+			recentId = dates->id;
+			return range->text;
+		}
+	}
+	return NULL;
+}
+
+DATES *datesCreate(const char *format) {
+	DATES *dates = calloc(1, sizeof(DATES));
+	if (!dates) return NULL;
+
+	dates->format = strdup(format);
+	dates->bucketCount = DATE_BUCKETS;
+	dates->interned = calloc(dates->bucketCount, sizeof(struct interned_date *));
+	if (!dates->format || !dates->interned) {
+		free(dates->interned);
+		free(dates->format);
+		free(dates);
+		return NULL;
+	}
+	dates->unit = unitOf(format);
+	dates->id = __atomic_add_fetch(&lastId, 1, __ATOMIC_RELAXED);
+	pthread_mutex_init(&dates->lock, NULL);
+
+	/* Once per run, and localtime_r() takes it from there */
+	tzset();
+	return dates;
+}
+
+/* Returns NULL if the format gives an empty text (or memory ran out) */
+const char *datesFormat(DATES *dates, time_t time) {
+	if (recentId == dates->id && recent.start <= time && time < recent.end) {
+		return recent.text;
+	}
+
+	pthread_mutex_lock(&dates->lock);
+	const char *text = findRange(dates, time);
+	pthread_mutex_unlock(&dates->lock);
+	if (text) return text;
+
+	struct tm tm;
+	char rendered[256];
+	if (!localtime_r(&time, &tm)) return NULL;
+	size_t length = strftime(rendered, sizeof(rendered), dates->format, &tm);
+	if (length == 0) return NULL;
+
+	struct date_range range;
+	rangeOf(time, &tm, dates->unit, &range);
+
+	pthread_mutex_lock(&dates->lock);
+	range.text = intern(dates, rendered, length);
+	if (range.text) {
+		dates->ranges[dates->nextRange] = range;
+		dates->nextRange = (dates->nextRange + 1) % DATE_RANGES;
+		if (dates->rangeCount < DATE_RANGES) ++dates->rangeCount;
+
+		recent = range;
+		recentId = dates->id;
+	}
+	pthread_mutex_unlock(&dates->lock);
+
+	return range.text;
+}
+
+void datesDestroy(DATES *dates) {
+	if (!dates) return;
+
+	for (size_t i = 0; i < dates->bucketCount; ++i) {
+		struct interned_date *date = dates->interned[i];
+		while (date) {
+			struct interned_date *next = date->next;
+			free(date);
+			date = next;
+		}
+	}
+	pthread_mutex_destroy(&dates->lock);
+	free(dates->interned);
+	free(dates->format);
+	free(dates);
+}
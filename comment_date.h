@@ -0,0 +1,17 @@
+/**
+ * @file comment_date.h
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#ifndef COMMENT_DATE_H
+#define COMMENT_DATE_H
+
+#include <time.h>
+
+typedef struct comment_dates DATES;
+
+DATES *datesCreate(const char *format);
+const char *datesFormat(DATES *dates, time_t time);
+void datesDestroy(DATES *dates);
+
+#endif
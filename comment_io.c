@@ -0,0 +1,579 @@
+/**
+ * @file comment_io.c
+ * @brief file reading and replacing helpers shared by the handlers
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <utime.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include "comment_io.h"
+#include "comment_stats.h"
+
+/* Reads the file with plain read() calls, for files that can't be mapped */
+static int readWholeFile(int fd, size_t length, MAPPING *map) {
+	char *buffer = malloc(length ? length : 1);
+	if (!buffer) return -1;
+
+	size_t done = 0;
+	while (done < length) {
+		ssize_t count = pread(fd, &buffer[done], length - done, done);
+		if (count < 0 && errno == EINTR) continue;
+		if (count <= 0) break;
+		done += count;
+	}
+
+	map->data = buffer;
+	map->length = done;
+	map->mapped = 0;
+	return 0;
+}
+
+/* Maps the first limit bytes of an open file, or all of it if limit is 0 */
+int mapDescriptor(int fd, size_t limit, MAPPING *map) {
+	map->data = NULL;
+	map->length = 0;
+	map->mapped = 0;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) return -1;
+
+	size_t length = st.st_size;
+	if (limit > 0 && limit < length) length = limit;
+
+	int result = 0;
+	if (length > 0) {
+		void *data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			madvise(data, length, MADV_SEQUENTIAL);
+			map->data = data;
+			map->length = length;
+			map->mapped = 1;
+		}
+		else {
+			result = readWholeFile(fd, length, map);
+		}
+	}
+
+	return result;
+}
+
+/* Maps the first limit bytes of the file, or all of it if limit is 0 */
+int mapFile(const char *filename, size_t limit, MAPPING *map) {
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		map->data = NULL;
+		map->length = 0;
+		map->mapped = 0;
+		return -1;
+	}
+
+	int result = mapDescriptor(fd, limit, map);
+	close(fd);
+	return result;
+}
+
+void unmapFile(MAPPING *map) {
+	if (map->mapped) {
+		munmap((void *)map->data, map->length);
+	}
+	else {
+		free((void *)map->data);
+	}
+	map->data = NULL;
+	map->length = 0;
+	map->mapped = 0;
+}
+
+/* VIEWS
+ * comment() opens every file exactly once, and reads its first block with a
+ * single pread(). That block is shared by type detection, scanning and
+ * rewriting, and for most source files it is the whole file. Only when a
+ * handler needs more than the first block is the file mapped, through the
+ * same descriptor.
+ */
+
+static int openView(const char *filename, VIEW *view, struct stat *st) {
+	memset(view, 0, sizeof(VIEW));
+
+	view->fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (view->fd < 0) {
+		view->fd = -1;
+		return -1;
+	}
+
+	if (fstat(view->fd, st) != 0) {
+		viewClose(view);
+		return -1;
+	}
+	view->size = st->st_size;
+
+	size_t wanted = (st->st_size < VIEW_BLOCK_SIZE) ? (size_t)st->st_size : VIEW_BLOCK_SIZE;
+	view->block = malloc(wanted ? wanted : 1);
+	if (!view->block) {
+		viewClose(view);
+		return -1;
+	}
+
+	while (view->length < wanted) {
+		ssize_t count = pread(view->fd, &view->block[view->length], wanted - view->length, view->length);
+		if (count < 0 && errno == EINTR) continue;
+		if (count <= 0) break;
+		view->length += count;
+	}
+	view->data = view->block;
+	statsCount(STATS_BYTES_READ, view->length);
+
+	return 0;
+}
+
+int viewOpen(const char *filename, VIEW *view, struct stat *st) {
+	statsEnter(STATS_READ);
+	int result = openView(filename, view, st);
+	statsLeave();
+	return result;
+}
+
+void viewFromMemory(VIEW *view, const char *data, size_t length) {
+	memset(view, 0, sizeof(VIEW));
+	view->fd = -1;
+	view->data = length ? data : "";
+	view->length = length;
+	view->size = length;
+}
+
+/* Makes the first limit bytes of the file available, or all of it if limit is 0.
+ * A file that is already partly mapped is mapped again, further, so anything
+ * pointing into the old data has to be found again afterwards. */
+int viewExtend(VIEW *view, off_t limit) {
+	off_t wanted = (limit > 0 && limit < view->size) ? limit : view->size;
+	if (wanted <= (off_t)view->length) return 0;
+
+	MAPPING map;
+	statsEnter(STATS_READ);
+	int result = mapDescriptor(view->fd, wanted, &map);
+	statsLeave();
+	if (result != 0) return -1;
+
+	/* The file shrank since it was opened */
+	if (map.length <= view->length) {
+		unmapFile(&map);
+		return -1;
+	}
+
+	statsCount(STATS_BYTES_READ, map.length - view->length);
+	if (view->map.data) unmapFile(&view->map);
+	free(view->block);
+	view->block = NULL;
+	view->map = map;
+	view->data = view->map.data;
+	view->length = view->map.length;
+	return 0;
+}
+
+void viewClose(VIEW *view) {
+	if (view->map.data) unmapFile(&view->map);
+	free(view->block);
+	if (view->fd >= 0) close(view->fd);
+
+	view->fd = -1;
+	view->data = NULL;
+	view->length = 0;
+	view->block = NULL;
+}
+
+/* Overwrites length bytes at offset, leaving the rest of the file untouched,
+ * and then puts the times back */
+int patchFile(const char *filename, off_t offset, const char *text, size_t length, const struct stat *st) {
+	statsEnter(STATS_WRITE);
+	int fd = open(filename, O_WRONLY | O_CLOEXEC);
+	if (fd < 0) {
+		statsLeave();
+		return -1;
+	}
+
+	ssize_t written = pwrite(fd, text, length, offset);
+	int result = (written == (ssize_t)length) ? 0 : -1;
+	if (written > 0) statsCount(STATS_BYTES_WRITTEN, written);
+
+	struct timespec times[2];
+	times[0] = st->st_atim;
+	times[1] = st->st_mtim;
+	statsEnter(STATS_TIMES);
+	futimens(fd, times);
+	statsLeave();
+
+	if (close(fd) != 0) result = -1;
+	statsLeave();
+	return result;
+}
+
+static void restoreTimes(const char *filename, const struct stat *st) {
+	struct utimbuf utb;
+	utb.actime = st->st_atime;
+	utb.modtime = st->st_mtime;
+	statsEnter(STATS_TIMES);
+	utime(filename, &utb);
+	statsLeave();
+}
+
+/* REPLACING FILES
+ * The new content is written once, into a file in the same directory as the
+ * original. Preferably that is an anonymous O_TMPFILE, which is given a hidden
+ * name with linkat() when it is complete. The hidden file then gets the mode,
+ * owner and times of the original, is flushed to disk with fdatasync(), and
+ * is renamed over it with renameat(), so a crash never leaves a half written
+ * source file behind.
+ *
+ * Renaming gives the file a new inode, which would break hard links and can't
+ * keep an owner we aren't allowed to chown to. In those cases the finished
+ * temp file is copied over the original instead, like before. That is also
+ * what happens when the directory isn't writable, and the temp file has to be
+ * created in /tmp.
+ */
+
+static __thread unsigned int tempCounter;
+
+static void nextTempName(REPLACEMENT *replace) {
+	snprintf(replace->tempname, sizeof(replace->tempname), ".comment-%ld-%u",
+		(long)syscall(SYS_gettid), tempCounter++);
+}
+
+static FILE *createTemp(const char *filename, REPLACEMENT *replace) {
+	replace->file = NULL;
+	replace->fd = -1;
+	replace->dirfd = -1;
+	replace->anonymous = 0;
+	replace->sameDirectory = 1;
+	replace->tempname[0] = '\0';
+
+	/* A symbolic link is replaced by replacing the file it points to */
+	struct stat st;
+	if (lstat(filename, &st) == 0 && S_ISLNK(st.st_mode)) {
+		replace->target = realpath(filename, NULL);
+	}
+	else {
+		replace->target = strdup(filename);
+	}
+	if (!replace->target) return NULL;
+
+	char *lastSlash = strrchr(replace->target, '/');
+	if (lastSlash == NULL) {
+		replace->dirfd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+	}
+	else if (lastSlash == replace->target) {
+		replace->dirfd = open("/", O_PATH | O_DIRECTORY | O_CLOEXEC);
+	}
+	else {
+		*lastSlash = '\0';
+		replace->dirfd = open(replace->target, O_PATH | O_DIRECTORY | O_CLOEXEC);
+		*lastSlash = '/';
+	}
+	if (replace->dirfd < 0) {
+		abortReplace(replace);
+		return NULL;
+	}
+
+	replace->fd = openat(replace->dirfd, ".", O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+	if (replace->fd >= 0) {
+		replace->anonymous = 1;
+	}
+	else {
+		/* No O_TMPFILE support in this kernel or file system - use a hidden file */
+		for (int tries = 0; tries < 100 && replace->fd < 0; ++tries) {
+			nextTempName(replace);
+			replace->fd = openat(replace->dirfd, replace->tempname, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600);
+			if (replace->fd < 0 && errno != EEXIST) break;
+		}
+		if (replace->fd < 0) {
+			replace->tempname[0] = '\0';
+			replace->sameDirectory = 0;
+			replace->fd = open("/tmp", O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+		}
+		if (replace->fd < 0) {
+			abortReplace(replace);
+			return NULL;
+		}
+	}
+
+	replace->file = fdopen(replace->fd, "w+");
+	if (!replace->file) {
+		abortReplace(replace);
+		return NULL;
+	}
+
+	return replace->file;
+}
+
+FILE *beginReplace(const char *filename, REPLACEMENT *replace) {
+	statsEnter(STATS_WRITE);
+	FILE *file = createTemp(filename, replace);
+	statsLeave();
+	return file;
+}
+
+static int copyBack(REPLACEMENT *replace, const struct stat *st) {
+	int output = open(replace->target, O_WRONLY | O_TRUNC | O_CLOEXEC);
+	if (output < 0) return -1;
+
+	char buffer[65536];
+	ssize_t count;
+	off_t offset = 0;
+	int result = 0;
+	while ((count = pread(replace->fd, buffer, sizeof(buffer), offset)) > 0) {
+		if (write(output, buffer, count) != count) {
+			result = -1;
+			break;
+		}
+		statsCount(STATS_BYTES_READ, count);
+		statsCount(STATS_BYTES_WRITTEN, count);
+		offset += count;
+	}
+	if (count < 0) result = -1;
+
+	if (close(output) != 0) result = -1;
+	if (result == 0) restoreTimes(replace->target, st);
+	return result;
+}
+
+static int swapIn(REPLACEMENT *replace, const struct stat *st) {
+	int result = 0;
+	int saved;
+
+	if (fflush(replace->file) != 0) {
+		saved = errno;
+		abortReplace(replace);
+		errno = saved;
+		return -1;
+	}
+
+	int keepInode = (st->st_nlink > 1 || !replace->sameDirectory);
+	fchmod(replace->fd, st->st_mode & 07777);
+	if ((st->st_uid != geteuid() || st->st_gid != getegid()) && fchown(replace->fd, st->st_uid, st->st_gid) != 0) {
+		keepInode = 1;
+	}
+
+	if (keepInode) {
+		result = copyBack(replace, st);
+		saved = errno;
+		abortReplace(replace);
+		errno = saved;
+		return result;
+	}
+
+	struct timespec times[2];
+	times[0] = st->st_atim;
+	times[1] = st->st_mtim;
+	statsEnter(STATS_TIMES);
+	futimens(replace->fd, times);
+	statsLeave();
+
+	/* Without this, a file system that delays allocation can put the new
+	 * name on disk before the data, and a crash leaves an empty file */
+	if (fdatasync(replace->fd) != 0) {
+		saved = errno;
+		abortReplace(replace);
+		errno = saved;
+		return -1;
+	}
+
+	if (replace->anonymous) {
+		char procname[64];
+		snprintf(procname, sizeof(procname), "/proc/self/fd/%d", replace->fd);
+		for (int tries = 0; tries < 100; ++tries) {
+			nextTempName(replace);
+			result = linkat(AT_FDCWD, procname, replace->dirfd, replace->tempname, AT_SYMLINK_FOLLOW);
+			if (result == 0 || errno != EEXIST) break;
+		}
+		if (result != 0) {
+			/* Without /proc there is no way to give the file a name - copy it instead */
+			replace->tempname[0] = '\0';
+			result = copyBack(replace, st);
+			saved = errno;
+			abortReplace(replace);
+			errno = saved;
+			return result;
+		}
+	}
+
+	const char *lastSlash = strrchr(replace->target, '/');
+	const char *base = lastSlash ? lastSlash + 1 : replace->target;
+	result = renameat(replace->dirfd, replace->tempname, replace->dirfd, base);
+	saved = errno;
+	if (result == 0) replace->tempname[0] = '\0';
+	abortReplace(replace);
+	errno = saved;
+	return result;
+}
+
+int commitReplace(REPLACEMENT *replace, const struct stat *st) {
+	statsEnter(STATS_REPLACE);
+	int result = swapIn(replace, st);
+	statsLeave();
+	return result;
+}
+
+/* Cleans up after a replacement - the original file is left as it is unless
+ * commitReplace() already swapped the new file in */
+void abortReplace(REPLACEMENT *replace) {
+	if (replace->tempname[0] != '\0' && replace->dirfd >= 0) {
+		unlinkat(replace->dirfd, replace->tempname, 0);
+		replace->tempname[0] = '\0';
+	}
+	if (replace->file) {
+		fclose(replace->file);
+	}
+	else if (replace->fd >= 0) {
+		close(replace->fd);
+	}
+	if (replace->dirfd >= 0) {
+		close(replace->dirfd);
+	}
+	free(replace->target);
+
+	replace->file = NULL;
+	replace->fd = -1;
+	replace->dirfd = -1;
+	replace->target = NULL;
+}
+
+/* COPYING FILE CONTENTS
+ * When a new header is inserted, the rest of the original file is unchanged.
+ * The header is written together with the first chunk of the file in a single
+ * writev(), straight from the view, and the remainder is moved by the kernel
+ * with copy_file_range().
+ * Where that isn't supported (older kernels, some file system combinations)
+ * sendfile() is tried, and as a last resort a large buffer with read/write.
+ */
+
+#define FIRST_CHUNK_SIZE 65536
+#define COPY_BUFFER_SIZE (1024 * 1024)
+
+static int writeAll(int output, struct iovec *iov, int count) {
+	while (count > 0) {
+		ssize_t written = writev(output, iov, count);
+		if (written < 0 && errno == EINTR) continue;
+		if (written < 0) return -1;
+		statsCount(STATS_BYTES_WRITTEN, written);
+
+		while (count > 0 && (size_t)written >= iov->iov_len) {
+			written -= iov->iov_len;
+			++iov;
+			--count;
+		}
+		if (count > 0) {
+			iov->iov_base = (char *)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	return 0;
+}
+
+static int copyBody(int output, int input, off_t offset) {
+	loff_t position = offset;
+	ssize_t count;
+
+	while ((count = copy_file_range(input, &position, output, NULL, 1 << 30, 0)) > 0) {
+		statsCount(STATS_BYTES_WRITTEN, count);
+	}
+	if (count == 0) return 0;
+	if (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP && errno != EBADF) return -1;
+
+	off_t sendPosition = position;
+	while ((count = sendfile(output, input, &sendPosition, 1 << 30)) > 0) {
+		statsCount(STATS_BYTES_WRITTEN, count);
+	}
+	if (count == 0) return 0;
+	if (errno != EINVAL && errno != ENOSYS) return -1;
+
+	char *buffer = malloc(COPY_BUFFER_SIZE);
+	if (!buffer) return -1;
+
+	int result = 0;
+	position = sendPosition;
+	for (;;) {
+		count = pread(input, buffer, COPY_BUFFER_SIZE, position);
+		if (count < 0 && errno == EINTR) continue;
+		if (count <= 0) {
+			if (count < 0) result = -1;
+			break;
+		}
+		statsCount(STATS_BYTES_READ, count);
+
+		struct iovec iov;
+		iov.iov_base = buffer;
+		iov.iov_len = count;
+		if (writeAll(output, &iov, 1) != 0) {
+			result = -1;
+			break;
+		}
+		position += count;
+	}
+
+	free(buffer);
+	return result;
+}
+
+/* Writes the parts followed by everything in the file from offset and on.
+ * There must be room for one more entry in parts, for the first chunk. */
+static int writeParts(int output, struct iovec *parts, int count, const VIEW *view, off_t offset) {
+	if (offset < (off_t)view->length) {
+		size_t chunk = view->length - offset;
+		if (chunk > FIRST_CHUNK_SIZE) chunk = FIRST_CHUNK_SIZE;
+
+		parts[count].iov_base = (void *)&view->data[offset];
+		parts[count++].iov_len = chunk;
+		offset += chunk;
+	}
+
+	if (writeAll(output, parts, count) != 0) return -1;
+	if (offset >= view->size) return 0;
+
+	return copyBody(output, view->fd, offset);
+}
+
+int writePartsAndRest(int output, struct iovec *parts, int count, const VIEW *view, off_t offset) {
+	statsEnter(STATS_WRITE);
+	int result = writeParts(output, parts, count, view, offset);
+	statsLeave();
+	return result;
+}
+
+/* The same as writePartsAndRest(), but into memory, for a view that is all
+ * in memory already. Nothing is added to the output unless all of it fits. */
+int bufferPartsAndRest(COMMENT_BUFFER *output, const struct iovec *parts, int count, const VIEW *view, off_t offset) {
+	size_t total = 0;
+	for (int i = 0; i < count; ++i) total += parts[i].iov_len;
+	if (offset < (off_t)view->length) total += view->length - offset;
+
+	if (output->length + total > output->capacity) {
+		size_t capacity = output->capacity ? output->capacity : 4096;
+		while (capacity < output->length + total) capacity *= 2;
+		char *data = realloc(output->data, capacity);
+		if (!data) return -1;
+		output->data = data;
+		output->capacity = capacity;
+	}
+
+	for (int i = 0; i < count; ++i) {
+		memcpy(&output->data[output->length], parts[i].iov_base, parts[i].iov_len);
+		output->length += parts[i].iov_len;
+	}
+	if (offset < (off_t)view->length) {
+		memcpy(&output->data[output->length], &view->data[offset], view->length - offset);
+		output->length += view->length - offset;
+	}
+	return 0;
+}
@@ -0,0 +1,68 @@
+/**
+ * @file comment_io.h
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#ifndef COMMENT_IO_H
+#define COMMENT_IO_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "libcomment.h"
+
+struct comment_mapping {
+	const char *data;
+	size_t length;
+	int mapped;
+};
+
+typedef struct comment_mapping MAPPING;
+
+#define VIEW_BLOCK_SIZE 65536
+
+/* A file opened once, with its first block read (or all of it mapped) */
+struct comment_view {
+	int fd;
+	const char *data;
+	size_t length;
+	off_t size;
+	char *block;
+	MAPPING map;
+};
+
+typedef struct comment_view VIEW;
+
+/* A view of text that is already in memory has no descriptor, and is all
+ * there from the start */
+#define VIEW_IS_OPEN(view) ((view)->data != NULL)
+
+struct comment_replacement {
+	FILE *file;
+	int fd;
+	int dirfd;
+	int anonymous;
+	int sameDirectory;
+	char *target;
+	char tempname[64];
+};
+
+typedef struct comment_replacement REPLACEMENT;
+
+int mapDescriptor(int fd, size_t limit, MAPPING *map);
+int mapFile(const char *filename, size_t limit, MAPPING *map);
+void unmapFile(MAPPING *map);
+int viewOpen(const char *filename, VIEW *view, struct stat *st);
+void viewFromMemory(VIEW *view, const char *data, size_t length);
+int viewExtend(VIEW *view, off_t limit);
+void viewClose(VIEW *view);
+int patchFile(const char *filename, off_t offset, const char *text, size_t length, const struct stat *st);
+FILE *beginReplace(const char *filename, REPLACEMENT *replace);
+int commitReplace(REPLACEMENT *replace, const struct stat *st);
+void abortReplace(REPLACEMENT *replace);
+int writePartsAndRest(int output, struct iovec *parts, int count, const VIEW *view, off_t offset);
+int bufferPartsAndRest(COMMENT_BUFFER *output, const struct iovec *parts, int count, const VIEW *view, off_t offset);
+
+#endif
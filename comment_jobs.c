@@ -0,0 +1,101 @@
+/**
+ * @file comment_jobs.c
+ * @brief compact records for queued files, allocated from shared blocks
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "comment_jobs.h"
+
+/* ARENA
+ * A queued file is a pointer to its block and one for the caller, followed
+ * by the path, rounded up to the next pointer boundary, so a million typical
+ * paths fit in a few tens of MB, without a malloc() or a fixed size buffer
+ * per path. Records are cut from 64 KB blocks, one after the other, and
+ * never move. A block counts the records that are not done yet, and is
+ * freed when the last of them is done, after the block has filled up. A
+ * path longer than a block gets a block of its own.
+ */
+
+#define JOBS_BLOCK_SIZE 65536
+#define JOBS_ALIGN(size) (((size) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+struct comment_job_block {
+	size_t used;
+	size_t capacity;
+	int pending;
+	int filling;
+	void *data[];
+};
+
+struct comment_jobs {
+	pthread_mutex_t lock;
+	struct comment_job_block *current;
+};
+
+JOBS *jobsCreate(void) {
+	JOBS *jobs = calloc(1, sizeof(JOBS));
+	if (!jobs) return NULL;
+
+	pthread_mutex_init(&jobs->lock, NULL);
+	return jobs;
+}
+
+/* Only call with the lock held */
+static void retire(struct comment_job_block *block) {
+	block->filling = 0;
+	if (block->pending == 0) free(block);
+}
+
+/* The record stays valid until it is passed to jobsDone() */
+JOB *jobsAdd(JOBS *jobs, const char *path, size_t length) {
+	size_t size = JOBS_ALIGN(sizeof(JOB) + length + 1);
+
+	pthread_mutex_lock(&jobs->lock);
+	struct comment_job_block *block = jobs->current;
+	if (!block || block->used + size > block->capacity) {
+		if (block) retire(block);
+
+		size_t capacity = (size > JOBS_BLOCK_SIZE) ? size : JOBS_BLOCK_SIZE;
+		block = malloc(sizeof(struct comment_job_block) + capacity);
+		jobs->current = block;
+		if (!block) {
+			pthread_mutex_unlock(&jobs->lock);
+			return NULL;
+		}
+		block->used = 0;
+		block->capacity = capacity;
+		block->pending = 0;
+		block->filling = 1;
+	}
+
+	JOB *job = (JOB *)((char *)block->data + block->used);
+	block->used += size;
+	++block->pending;
+	pthread_mutex_unlock(&jobs->lock);
+
+	job->block = block;
+	job->user = NULL;
+	memcpy(job->path, path, length);
+	job->path[length] = '\0';
+	return job;
+}
+
+void jobsDone(JOBS *jobs, JOB *job) {
+	pthread_mutex_lock(&jobs->lock);
+	struct comment_job_block *block = job->block;
+	if (--block->pending == 0 && !block->filling) free(block);
+	pthread_mutex_unlock(&jobs->lock);
+}
+
+/* All records must be done by now */
+void jobsDestroy(JOBS *jobs) {
+	if (!jobs) return;
+
+	if (jobs->current) retire(jobs->current);
+	pthread_mutex_destroy(&jobs->lock);
+	free(jobs);
+}
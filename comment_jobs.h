@@ -0,0 +1,28 @@
+/**
+ * @file comment_jobs.h
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#ifndef COMMENT_JOBS_H
+#define COMMENT_JOBS_H
+
+#include <stddef.h>
+
+typedef struct comment_jobs JOBS;
+
+/* One queued file, with its path stored right after the record, and
+ * whatever the one that queued it needs to handle it */
+struct comment_job {
+	struct comment_job_block *block;
+	void *user;
+	char path[];
+};
+
+typedef struct comment_job JOB;
+
+JOBS *jobsCreate(void);
+JOB *jobsAdd(JOBS *jobs, const char *path, size_t length);
+void jobsDone(JOBS *jobs, JOB *job);
+void jobsDestroy(JOBS *jobs);
+
+#endif
@@ -0,0 +1,227 @@
+/**
+ * @file comment_line.c
+ * @brief shared engine for languages with line comments (shell, make, tex)
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "comment_line.h"
+#include "comment_io.h"
+#include "comment_stats.h"
+
+/* The view of the file that comment() opened is used for finding the date
+ * line, for checking if it is already current, and as the source of
+ * everything in front of the date line when the file is rewritten. The rest
+ * of the file is copied by the kernel from the same descriptor.
+ *
+ * A date line is a line starting with the marker, an optional space and
+ * "Date:" or "date:", like "# Date: 2017-08-30" or "%date: 170830". Only
+ * lines in the header are looked at: a #! line, comment lines and blank
+ * lines at the top of the file, and with a header window, only the ones
+ * starting inside it. The first line that can't be part of a header ends
+ * the scan, so most files are done with the block that was read first.
+ */
+
+/* Comment lines and blank lines, indented or not, can be part of a header */
+static int inHeader(const char *line, const char *next, const LINE_SYNTAX *syntax) {
+	const char *p = line;
+	while (p < next && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\f' || *p == '\v')) ++p;
+	return p == next || *p == '\n' || *p == syntax->marker;
+}
+
+/* Finds the date line in a buffer, looking at the header lines that start
+ * in the first window bytes (or all of them if window is 0) */
+void scanLines(const char *start, const char *end, off_t window, const LINE_SYNTAX *syntax, LINE_MATCH *match) {
+	const char *scanEnd = (window > 0 && window < end - start) ? start + window : end;
+
+	memset(match, 0, sizeof(LINE_MATCH));
+	match->headerEnded = (scanEnd < end);
+
+	const char *line = start;
+	while (line < scanEnd) {
+		const char *newline = memchr(line, '\n', end - line);
+		const char *next = newline ? newline + 1 : end;
+
+		if (*line == syntax->marker) {
+			const char *p = line + 1;
+			int extraSpace = 0;
+			if (p < next && *p == ' ') {
+				extraSpace = 1;
+				++p;
+			}
+
+			if (next - p >= 5 && (memcmp(p, "Date:", 5) == 0 || memcmp(p, "date:", 5) == 0)) {
+				match->found = 1;
+				match->headerEnded = 1;
+				match->lineStart = line - start;
+				match->lineEnd = next - start;
+				match->extraSpace = extraSpace;
+				match->upperCaseFirst = (*p == 'D');
+				return;
+			}
+		}
+
+		if (line == start && syntax->keepHashBang && next - line >= 2 && line[0] == '#' && line[1] == '!') {
+			match->hashBangEnd = next - start;
+		}
+		else if (!inHeader(line, next, syntax)) {
+			match->headerEnded = 1;
+			return;
+		}
+
+		line = next;
+	}
+}
+
+static int replaceWithParts(COMMENT *data, const LINE_SYNTAX *syntax, const char *action,
+		struct iovec *parts, int count, off_t offset) {
+	if (data->output) {
+		if (bufferPartsAndRest(data->output, parts, count, &data->view, offset) != 0) {
+			fprintf(stderr, "Out of memory while %s %s comment in '%s'\n", action, syntax->name, data->filename);
+			return 2;
+		}
+		return 0;
+	}
+
+	REPLACEMENT replace;
+	if (!beginReplace(data->filename, &replace)) {
+		fprintf(stderr, "Could not create temporary file: %s\n", strerror(errno));
+		return 2;
+	}
+
+	if (writePartsAndRest(replace.fd, parts, count, &data->view, offset) != 0) {
+		fprintf(stderr, "Could not write temporary file for '%s': %s\n", data->filename, strerror(errno));
+		abortReplace(&replace);
+		return 2;
+	}
+
+	/* Swap the temp file in for the original, keeping its mode, owner and times */
+	if (commitReplace(&replace, &data->stat) != 0) {
+		fprintf(stderr, "When moving temporary file over the original file, %s\n"
+				"%s comment, the original file could not be overwritten: %s\n",
+				action, syntax->name, strerror(errno));
+		return 2;
+	}
+
+	return 0;
+}
+
+static int modifyLineComment(COMMENT *data, const LINE_SYNTAX *syntax, const LINE_MATCH *match) {
+	const VIEW *view = &data->view;
+	char dateLine[512];
+	int dateLineSize = snprintf(dateLine, sizeof(dateLine), "%c%s%cate: %s\n",
+		syntax->marker,
+		(match->extraSpace ? " " : ""),
+		(match->upperCaseFirst ? 'D' : 'd'),
+		data->datetext);
+
+	int sameLength = (dateLineSize == match->lineEnd - match->lineStart);
+
+	/* Nothing to write if the file already has the current date */
+	if (sameLength && memcmp(&view->data[match->lineStart], dateLine, dateLineSize) == 0) {
+		data->skipped = 1;
+		return 0;
+	}
+
+	/* In check mode, a date line that would be rewritten is just reported */
+	if (data->checkOnly) {
+		data->stale = 1;
+		return 0;
+	}
+
+	/* Just as long as the old date line, so overwrite it in place */
+	if (sameLength && !data->output && patchFile(data->filename, match->lineStart, dateLine, dateLineSize, &data->stat) == 0) {
+		statsCount(STATS_MODIFIED, 1);
+		return 0;
+	}
+
+	/* Everything until the existing date line, the new date line, and everything after it */
+	struct iovec parts[3];
+	parts[0].iov_base = (void *)view->data;
+	parts[0].iov_len = match->lineStart;
+	parts[1].iov_base = dateLine;
+	parts[1].iov_len = dateLineSize;
+
+	int result = replaceWithParts(data, syntax, "modifying a", parts, 2, match->lineEnd);
+	if (result == 0) statsCount(STATS_MODIFIED, 1);
+	return result;
+}
+
+static int addNewLineComment(COMMENT *data, const LINE_SYNTAX *syntax, const LINE_MATCH *match) {
+	if (data->checkOnly) {
+		data->stale = 1;
+		return 0;
+	}
+
+	const VIEW *view = &data->view;
+	char header[2048];
+	int headerLength = snprintf(header, sizeof(header),
+		"%c Makefile\n"
+		"%c Author: %s\n"
+		"%c Date: %s\n"
+		"\n",
+		syntax->marker,
+		syntax->marker, data->author,
+		syntax->marker, data->datetext);
+
+	/* A #! line has to stay first, so the header goes in right after it */
+	struct iovec parts[4];
+	int count = 0;
+	if (match->hashBangEnd > 0) {
+		size_t lineLength = match->hashBangEnd;
+		if (view->data[lineLength - 1] == '\n') --lineLength;
+
+		parts[count].iov_base = (void *)view->data;
+		parts[count++].iov_len = lineLength;
+		parts[count].iov_base = "\n";
+		parts[count++].iov_len = 1;
+	}
+	parts[count].iov_base = header;
+	parts[count++].iov_len = headerLength;
+
+	int result = replaceWithParts(data, syntax, "adding a new", parts, count, match->hashBangEnd);
+	if (result == 0) statsCount(STATS_ADDED, 1);
+	return result;
+}
+
+int commentLines(COMMENT *data, const LINE_SYNTAX *syntax) {
+	if (!VIEW_IS_OPEN(&data->view)) {
+		fprintf(stderr, "Could not open file '%s'\n", data->filename);
+		return 1;
+	}
+
+	LINE_MATCH match;
+	statsEnter(STATS_SCAN);
+	for (;;) {
+		scanLines(data->view.data, data->view.data + data->view.length, data->headerWindow, syntax, &match);
+
+		/* Done, unless the header goes on past what was read so far, or the
+		 * line that matters does - cutting it short would tear it in two */
+		off_t lineEnd = match.found ? match.lineEnd : match.hashBangEnd;
+		if (data->view.length >= data->view.size || (match.headerEnded && lineEnd < (off_t)data->view.length)) break;
+
+		/* First as far as the window goes, then all of it */
+		off_t limit = (data->headerWindow > (off_t)data->view.length) ? data->headerWindow : 0;
+		if (viewExtend(&data->view, limit) != 0) {
+			statsLeave();
+			fprintf(stderr, "Could not read file '%s'\n", data->filename);
+			return 1;
+		}
+	}
+	statsLeave();
+
+	if (match.found) {
+		return modifyLineComment(data, syntax, &match);
+	}
+	else {
+		return addNewLineComment(data, syntax, &match);
+	}
+}
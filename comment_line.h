@@ -0,0 +1,38 @@
+/**
+ * @file comment_line.h
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#ifndef COMMENT_LINE_H
+#define COMMENT_LINE_H
+
+#include "comment.h"
+
+/* Describes a language where the header is made of line comments */
+struct line_syntax {
+	const char *name;
+	char marker;
+	int keepHashBang;
+};
+
+typedef struct line_syntax LINE_SYNTAX;
+
+/* Where the date line is, and where a #! line that has to stay first ends.
+ * headerEnded is set when the scan got past the header (or the window),
+ * so more of the file couldn't change the outcome. */
+struct line_match {
+	int found;
+	off_t lineStart;
+	off_t lineEnd;
+	int extraSpace;
+	int upperCaseFirst;
+	off_t hashBangEnd;
+	int headerEnded;
+};
+
+typedef struct line_match LINE_MATCH;
+
+int commentLines(COMMENT *data, const LINE_SYNTAX *syntax);
+void scanLines(const char *start, const char *end, off_t window, const LINE_SYNTAX *syntax, LINE_MATCH *match);
+
+#endif
@@ -1,12 +1,15 @@
 /**
  * @file comment_makefile.h
  * @author Anders Tornblad
- * @date 2017-08-24
+ * @date 2026-10-18
  */
 #ifndef COMMENT_MAKEFILE_H
 #define COMMENT_MAKEFILE_H
 
 #include "comment.h"
+#include "comment_line.h"
+
+extern const LINE_SYNTAX MAKEFILE_SYNTAX;
 
 int commentMakefile(COMMENT *data);
 
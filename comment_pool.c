@@ -0,0 +1,256 @@
+/**
+ * @file comment_pool.c
+ * @brief work-stealing thread pool for processing many files at once
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include "comment_pool.h"
+#include "comment_trace.h"
+
+/* Every worker owns a deque of tasks. The owner pushes and pops at the back,
+ * idle workers steal from the front of somebody else's deque. Tasks submitted
+ * from outside the pool are spread round-robin over the deques.
+ *
+ * queued counts the tasks in the deques that no worker has claimed yet. It
+ * is only raised once a task is pushed, and a worker claims a task by
+ * lowering it before looking in the deques, so a worker that gets past the
+ * wait always has a task to find.
+ */
+
+struct pool_task {
+	POOL_TASK task;
+	void *arg;
+};
+
+struct pool_deque {
+	pthread_mutex_t lock;
+	struct pool_task *tasks;
+	int capacity;
+	int head;
+	int count;
+};
+
+struct pool_worker {
+	POOL *pool;
+	int index;
+	pthread_t thread;
+};
+
+struct comment_pool {
+	int threads;
+	struct pool_deque *deques;
+	struct pool_worker *workers;
+	pthread_mutex_t lock;
+	pthread_cond_t workAvailable;
+	pthread_cond_t allDone;
+	int queued;
+	int unfinished;
+	int shutdown;
+	int nextDeque;
+};
+
+static __thread int currentWorker = -1;
+static __thread POOL *currentPool = NULL;
+
+int poolOnlineCpus(void) {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return (cpus < 1) ? 1 : (int)cpus;
+}
+
+static void pushBack(struct pool_deque *deque, POOL_TASK task, void *arg) {
+	pthread_mutex_lock(&deque->lock);
+	if (deque->count == deque->capacity) {
+		int capacity = deque->capacity ? deque->capacity * 2 : 64;
+		struct pool_task *tasks = malloc(sizeof(struct pool_task) * capacity);
+		if (!tasks) {
+			fprintf(stderr, "Out of memory while queueing work\n");
+			abort();
+		}
+		for (int i = 0; i < deque->count; ++i) {
+			tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+		}
+		free(deque->tasks);
+		deque->tasks = tasks;
+		deque->capacity = capacity;
+		deque->head = 0;
+	}
+	struct pool_task *slot = &deque->tasks[(deque->head + deque->count) % deque->capacity];
+	slot->task = task;
+	slot->arg = arg;
+	++deque->count;
+	pthread_mutex_unlock(&deque->lock);
+}
+
+static int popBack(struct pool_deque *deque, struct pool_task *out) {
+	int found = 0;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->count > 0) {
+		--deque->count;
+		*out = deque->tasks[(deque->head + deque->count) % deque->capacity];
+		found = 1;
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+static int stealFront(struct pool_deque *deque, struct pool_task *out) {
+	int found = 0;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->count > 0) {
+		*out = deque->tasks[deque->head];
+		deque->head = (deque->head + 1) % deque->capacity;
+		--deque->count;
+		found = 1;
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+static int takeTask(POOL *pool, int index, struct pool_task *out) {
+	if (popBack(&pool->deques[index], out)) return 1;
+
+	for (int i = 1; i < pool->threads; ++i) {
+		if (stealFront(&pool->deques[(index + i) % pool->threads], out)) return 1;
+	}
+
+	return 0;
+}
+
+static void *workerMain(void *arg) {
+	struct pool_worker *worker = (struct pool_worker *)arg;
+	POOL *pool = worker->pool;
+	currentWorker = worker->index;
+	currentPool = pool;
+	traceThread();
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		int idle = (pool->queued == 0 && !pool->shutdown);
+		if (idle) traceBegin("idle", NULL);
+		while (pool->queued == 0 && !pool->shutdown) {
+			pthread_cond_wait(&pool->workAvailable, &pool->lock);
+		}
+		if (idle) traceEnd();
+		if (pool->queued == 0 && pool->shutdown) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		--pool->queued;
+		pthread_mutex_unlock(&pool->lock);
+
+		/* The claimed task is there, but another worker may take the one this
+		 * scan was headed for while the one left is in a deque already passed */
+		struct pool_task task;
+		while (!takeTask(pool, worker->index, &task)) {
+			sched_yield();
+		}
+
+		task.task(task.arg);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->unfinished == 0) {
+			pthread_cond_broadcast(&pool->allDone);
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return NULL;
+}
+
+POOL *poolCreate(int threads) {
+	if (threads < 1) threads = 1;
+
+	POOL *pool = calloc(1, sizeof(POOL));
+	if (!pool) return NULL;
+
+	pool->threads = threads;
+	pool->deques = calloc(threads, sizeof(struct pool_deque));
+	pool->workers = calloc(threads, sizeof(struct pool_worker));
+	if (!pool->deques || !pool->workers) {
+		free(pool->deques);
+		free(pool->workers);
+		free(pool);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->workAvailable, NULL);
+	pthread_cond_init(&pool->allDone, NULL);
+
+	for (int i = 0; i < threads; ++i) {
+		pthread_mutex_init(&pool->deques[i].lock, NULL);
+	}
+
+	for (int i = 0; i < threads; ++i) {
+		pool->workers[i].pool = pool;
+		pool->workers[i].index = i;
+		if (pthread_create(&pool->workers[i].thread, NULL, workerMain, &pool->workers[i]) != 0) {
+			fprintf(stderr, "Could not start worker thread\n");
+			abort();
+		}
+	}
+
+	return pool;
+}
+
+void poolSubmit(POOL *pool, POOL_TASK task, void *arg) {
+	int index;
+
+	pthread_mutex_lock(&pool->lock);
+	if (currentPool == pool) {
+		index = currentWorker;
+	}
+	else {
+		index = pool->nextDeque;
+		pool->nextDeque = (pool->nextDeque + 1) % pool->threads;
+	}
+	++pool->unfinished;
+	pthread_mutex_unlock(&pool->lock);
+
+	pushBack(&pool->deques[index], task, arg);
+
+	pthread_mutex_lock(&pool->lock);
+	++pool->queued;
+	pthread_cond_signal(&pool->workAvailable);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void poolWait(POOL *pool) {
+	pthread_mutex_lock(&pool->lock);
+	while (pool->unfinished > 0) {
+		pthread_cond_wait(&pool->allDone, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void poolDestroy(POOL *pool) {
+	if (!pool) return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->workAvailable);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->threads; ++i) {
+		pthread_join(pool->workers[i].thread, NULL);
+	}
+
+	for (int i = 0; i < pool->threads; ++i) {
+		pthread_mutex_destroy(&pool->deques[i].lock);
+		free(pool->deques[i].tasks);
+	}
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->workAvailable);
+	pthread_cond_destroy(&pool->allDone);
+	free(pool->deques);
+	free(pool->workers);
+	free(pool);
+}
@@ -0,0 +1,19 @@
+/**
+ * @file comment_pool.h
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#ifndef COMMENT_POOL_H
+#define COMMENT_POOL_H
+
+typedef void (*POOL_TASK)(void *arg);
+
+typedef struct comment_pool POOL;
+
+int poolOnlineCpus(void);
+POOL *poolCreate(int threads);
+void poolSubmit(POOL *pool, POOL_TASK task, void *arg);
+void poolWait(POOL *pool);
+void poolDestroy(POOL *pool);
+
+#endif
@@ -0,0 +1,434 @@
+/**
+ * @file comment_serve.c
+ * @brief a resident server for stamping files, and the client that talks to it
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "comment_serve.h"
+
+/* SERVING
+ * Starting comment once per file, like a makefile rule does, costs a process
+ * and a configuration read (with a user database lookup for the default
+ * author) every time. The server does that once and then takes requests on
+ * a Unix socket, one connection at a time.
+ *
+ * A request is the client's working directory, its TZ ("TZ=..." or nothing
+ * when it isn't set) and the paths, each ending with a NUL, and the client's
+ * stdout and stderr passed along as SCM_RIGHTS. The client shuts down its
+ * side when everything is sent. The server handles the files from the
+ * client's directory and with its TZ, with messages going to the client's
+ * own outputs, and answers with one return code byte per file. Only the user
+ * running the server may connect, since the files are written as that user.
+ *
+ * Requests are handled one at a time, so a client that connects and then
+ * never finishes its request would hold up everyone else. It gets
+ * SERVE_TIMEOUT_MS to send all of it.
+ */
+
+#define SERVE_BACKLOG 64
+#define SERVE_TIMEOUT_MS 5000
+
+static volatile sig_atomic_t stopping;
+
+static void stop(int signal) {
+	stopping = 1;
+}
+
+static int socketAddress(const char *socketPath, struct sockaddr_un *address) {
+	memset(address, 0, sizeof(struct sockaddr_un));
+	address->sun_family = AF_UNIX;
+	if (strlen(socketPath) >= sizeof(address->sun_path)) return -1;
+	strcpy(address->sun_path, socketPath);
+	return 0;
+}
+
+static int writeAll(int fd, const char *data, size_t length) {
+	while (length > 0) {
+		ssize_t written = send(fd, data, length, MSG_NOSIGNAL);
+		if (written < 0 && errno == EINTR) continue;
+		if (written <= 0) return -1;
+		data += written;
+		length -= written;
+	}
+	return 0;
+}
+
+static long long milliseconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Reads the whole request, picking up the passed descriptors on the way, or
+ * gives up if it takes longer than SERVE_TIMEOUT_MS */
+static char *readRequest(int connection, size_t *length, int *outputs) {
+	size_t capacity = 65536;
+	size_t used = 0;
+	char *data = malloc(capacity);
+	if (!data) return NULL;
+
+	long long deadline = milliseconds() + SERVE_TIMEOUT_MS;
+	for (;;) {
+		long long left = deadline - milliseconds();
+		struct pollfd pfd;
+		pfd.fd = connection;
+		pfd.events = POLLIN;
+		int ready = (left > 0) ? poll(&pfd, 1, (int)left) : 0;
+		if (ready < 0 && errno == EINTR) continue;
+		if (ready <= 0) {
+			if (ready == 0) fprintf(stderr, "Gave up on a client that did not finish its request\n");
+			break;
+		}
+
+		if (used == capacity) {
+			char *grown = realloc(data, capacity * 2);
+			if (!grown) break;
+			data = grown;
+			capacity *= 2;
+		}
+
+		union {
+			struct cmsghdr header;
+			char space[CMSG_SPACE(2 * sizeof(int))];
+		} control;
+		struct iovec part = { &data[used], capacity - used };
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = &part;
+		message.msg_iovlen = 1;
+		message.msg_control = control.space;
+		message.msg_controllen = sizeof(control.space);
+
+		ssize_t received = recvmsg(connection, &message, MSG_CMSG_CLOEXEC);
+		if (received < 0 && errno == EINTR) continue;
+		if (received < 0) break;
+
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+			if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+			int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			int fds[2] = { -1, -1 };
+			memcpy(fds, CMSG_DATA(cmsg), (count < 2 ? count : 2) * sizeof(int));
+			for (int i = 0; i < count && i < 2; ++i) {
+				if (outputs[i] >= 0) close(outputs[i]);
+				outputs[i] = fds[i];
+			}
+		}
+
+		if (received == 0) {
+			*length = used;
+			return data;
+		}
+		used += received;
+	}
+
+	free(data);
+	return NULL;
+}
+
+static int sameUser(int connection) {
+	struct ucred peer;
+	socklen_t size = sizeof(peer);
+	return getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &peer, &size) == 0 && peer.uid == getuid();
+}
+
+/* Switches to the client's TZ, keeping the server's own in saved */
+static void switchTimezone(const char *timezone, char **saved) {
+	const char *own = getenv("TZ");
+	*saved = own ? strdup(own) : NULL;
+
+	if (strncmp(timezone, "TZ=", 3) == 0) {
+		setenv("TZ", timezone + 3, 1);
+	}
+	else {
+		unsetenv("TZ");
+	}
+	tzset();
+}
+
+static void restoreTimezone(char *saved) {
+	if (saved) {
+		setenv("TZ", saved, 1);
+		free(saved);
+	}
+	else {
+		unsetenv("TZ");
+	}
+	tzset();
+}
+
+/* Points stdout and stderr at the client's while its files are handled */
+static void redirectOutputs(const int *from, int *saved) {
+	fflush(stdout);
+	fflush(stderr);
+	for (int i = 0; i < 2; ++i) {
+		saved[i] = -1;
+		if (from[i] < 0) continue;
+		saved[i] = dup(i + 1);
+		dup2(from[i], i + 1);
+	}
+}
+
+static void restoreOutputs(int *saved) {
+	fflush(stdout);
+	fflush(stderr);
+	for (int i = 0; i < 2; ++i) {
+		if (saved[i] < 0) continue;
+		dup2(saved[i], i + 1);
+		close(saved[i]);
+	}
+}
+
+static void handleConnection(int connection, int home, SERVE_BATCH batch, void *context) {
+	if (!sameUser(connection)) return;
+
+	int outputs[2] = { -1, -1 };
+	size_t length = 0;
+	char *data = readRequest(connection, &length, outputs);
+	if (!data || length == 0 || data[length - 1] != '\0') goto done;
+
+	int count = -2;
+	for (size_t i = 0; i < length; ++i) {
+		if (data[i] == '\0') ++count;
+	}
+	if (count < 0) goto done;
+
+	char **paths = malloc((count + 1) * sizeof(char *));
+	unsigned char *results = malloc(count + 1);
+	if (!paths || !results) {
+		free(paths);
+		free(results);
+		goto done;
+	}
+
+	const char *directory = data;
+	const char *timezone = directory + strlen(directory) + 1;
+	char *p = (char *)timezone + strlen(timezone) + 1;
+	for (int i = 0; i < count; ++i) {
+		paths[i] = p;
+		p += strlen(p) + 1;
+	}
+
+	int saved[2];
+	char *savedTimezone;
+	redirectOutputs(outputs, saved);
+	switchTimezone(timezone, &savedTimezone);
+	if (chdir(directory) == 0) {
+		batch(count, paths, results, context);
+	}
+	else {
+		fprintf(stderr, "Could not change to directory '%s': %s\n", directory, strerror(errno));
+		memset(results, 2, count);
+	}
+	restoreTimezone(savedTimezone);
+	restoreOutputs(saved);
+
+	if (fchdir(home) != 0) {
+		fprintf(stderr, "Could not return to the starting directory: %s\n", strerror(errno));
+		stopping = 1;
+	}
+
+	writeAll(connection, (const char *)results, count);
+	free(paths);
+	free(results);
+
+done:
+	free(data);
+	for (int i = 0; i < 2; ++i) {
+		if (outputs[i] >= 0) close(outputs[i]);
+	}
+}
+
+/* Takes requests until SIGINT or SIGTERM, in the directory it was started
+ * from whenever it is not handling one */
+int serveRun(const char *socketPath, SERVE_BATCH batch, void *context) {
+	struct sockaddr_un address;
+	if (socketAddress(socketPath, &address) != 0) {
+		fprintf(stderr, "Socket path is too long: '%s'\n", socketPath);
+		return 2;
+	}
+
+	int home = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (home < 0 || listener < 0) {
+		fprintf(stderr, "Could not start serving: %s\n", strerror(errno));
+		if (home >= 0) close(home);
+		if (listener >= 0) close(listener);
+		return 2;
+	}
+
+	/* A socket left behind by a server that is gone is replaced, but not one
+	 * that still answers */
+	struct stat st;
+	if (connect(listener, (struct sockaddr *)&address, sizeof(address)) == 0) {
+		fprintf(stderr, "Already serving on '%s'\n", socketPath);
+		close(listener);
+		close(home);
+		return 2;
+	}
+	if (lstat(socketPath, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		unlink(socketPath);
+	}
+
+	mode_t mask = umask(0077);
+	int bound = bind(listener, (struct sockaddr *)&address, sizeof(address));
+	umask(mask);
+	if (bound != 0 || listen(listener, SERVE_BACKLOG) != 0) {
+		fprintf(stderr, "Could not serve on '%s': %s\n", socketPath, strerror(errno));
+		close(listener);
+		close(home);
+		return 2;
+	}
+
+	/* No SA_RESTART, so that accept() returns when it is time to stop */
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = stop;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	/* A client that goes away must not take the server with it */
+	action.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &action, NULL);
+
+	fprintf(stdout, "Serving on '%s', stop with Ctrl+C\n", socketPath);
+	fflush(stdout);
+
+	while (!stopping) {
+		int connection = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+		if (connection < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			fprintf(stderr, "Could not accept connection: %s\n", strerror(errno));
+			break;
+		}
+
+		handleConnection(connection, home, batch, context);
+		close(connection);
+	}
+
+	close(listener);
+	unlink(socketPath);
+	close(home);
+
+	return 0;
+}
+
+/* Sends the paths to the server and returns the highest return code, or -1
+ * if there is no server to send them to */
+int serveClient(const char *socketPath, int count, char **paths) {
+	struct sockaddr_un address;
+	if (socketAddress(socketPath, &address) != 0) return -1;
+
+	int connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (connection < 0) return -1;
+	if (connect(connection, (struct sockaddr *)&address, sizeof(address)) != 0) {
+		close(connection);
+		return -1;
+	}
+
+	char directory[4096];
+	if (!getcwd(directory, sizeof(directory))) {
+		close(connection);
+		return -1;
+	}
+
+	/* The dates have to come out the same as when stamping locally */
+	char timezone[4096];
+	const char *tz = getenv("TZ");
+	if (tz && strlen(tz) + 4 > sizeof(timezone)) {
+		close(connection);
+		return -1;
+	}
+	if (tz) snprintf(timezone, sizeof(timezone), "TZ=%s", tz);
+	else timezone[0] = '\0';
+
+	size_t length = strlen(directory) + 1 + strlen(timezone) + 1;
+	for (int i = 0; i < count; ++i) length += strlen(paths[i]) + 1;
+	char *data = malloc(length);
+	if (!data) {
+		close(connection);
+		return -1;
+	}
+
+	char *p = data;
+	size_t part = strlen(directory) + 1;
+	memcpy(p, directory, part);
+	p += part;
+	part = strlen(timezone) + 1;
+	memcpy(p, timezone, part);
+	p += part;
+	for (int i = 0; i < count; ++i) {
+		part = strlen(paths[i]) + 1;
+		memcpy(p, paths[i], part);
+		p += part;
+	}
+
+	/* The descriptors go with the first bytes, the rest follows as a stream */
+	union {
+		struct cmsghdr header;
+		char space[CMSG_SPACE(2 * sizeof(int))];
+	} control;
+	memset(&control, 0, sizeof(control));
+	struct iovec first = { data, length };
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &first;
+	message.msg_iovlen = 1;
+	message.msg_control = control.space;
+	message.msg_controllen = sizeof(control.space);
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+	int outputs[2] = { STDOUT_FILENO, STDERR_FILENO };
+	memcpy(CMSG_DATA(cmsg), outputs, sizeof(outputs));
+
+	ssize_t sent;
+	do {
+		sent = sendmsg(connection, &message, MSG_NOSIGNAL);
+	} while (sent < 0 && errno == EINTR);
+
+	if (sent < 0 || writeAll(connection, data + sent, length - sent) != 0) {
+		free(data);
+		close(connection);
+		return -1;
+	}
+	free(data);
+	shutdown(connection, SHUT_WR);
+
+	/* From here on the server has the files, so losing it is an error */
+	int result = 0;
+	int answered = 0;
+	unsigned char results[4096];
+	while (answered < count) {
+		ssize_t received = read(connection, results, sizeof(results));
+		if (received < 0 && errno == EINTR) continue;
+		if (received <= 0) break;
+		for (ssize_t i = 0; i < received; ++i) {
+			if (results[i] > result) result = results[i];
+		}
+		answered += received;
+	}
+	close(connection);
+
+	if (answered < count) {
+		fprintf(stderr, "Lost connection to the server on '%s'\n", socketPath);
+		return 2;
+	}
+	return result;
+}
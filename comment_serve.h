@@ -0,0 +1,16 @@
+/**
+ * @file comment_serve.h
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#ifndef COMMENT_SERVE_H
+#define COMMENT_SERVE_H
+
+/* Handles the files of one request, run in the client's working directory
+ * with its stdout, stderr and TZ, and leaves a return code per file in results */
+typedef void (*SERVE_BATCH)(int count, char **paths, unsigned char *results, void *context);
+
+int serveRun(const char *socketPath, SERVE_BATCH batch, void *context);
+int serveClient(const char *socketPath, int count, char **paths);
+
+#endif
@@ -1,12 +1,15 @@
 /**
  * @file comment_sh.h
  * @author Anders Tornblad
- * @date 2017-08-24
+ * @date 2026-10-18
  */
 #ifndef COMMENT_SH_H
 #define COMMENT_SH_H
 
 #include "comment.h"
+#include "comment_line.h"
+
+extern const LINE_SYNTAX SH_SYNTAX;
 
 int commentSh(COMMENT *data);
 
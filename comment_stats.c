@@ -0,0 +1,156 @@
+/**
+ * @file comment_stats.c
+ * @brief per phase timings and counters for --stats
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include "comment_stats.h"
+#include "comment_trace.h"
+
+/* Every thread counts into a block of its own, so counting is a plain add
+ * with no locking. The blocks are put on a list the first time a thread
+ * counts anything, and are only added up when the report is printed, after
+ * all workers are done. They are allocated rather than thread local, since
+ * the workers are gone by then.
+ *
+ * Phases nest: entering a phase pauses the one the thread was in, and
+ * leaving it picks that one up again. That way restoring times inside a
+ * replace is counted as times and not also as replace. Neither of them
+ * changes errno, so they can be wrapped around calls whose error is
+ * reported afterwards. The same hooks record the phases as spans for --trace.
+ */
+
+#define STATS_MAX_DEPTH 8
+
+struct stats_block {
+	uint64_t phaseTime[STATS_PHASES];
+	uint64_t counters[STATS_COUNTERS];
+	int stack[STATS_MAX_DEPTH];
+	int depth;
+	uint64_t since;
+	struct stats_block *next;
+};
+
+int statsEnabled;
+
+static pthread_mutex_t blocksLock = PTHREAD_MUTEX_INITIALIZER;
+static struct stats_block *blocks;
+static __thread struct stats_block *local;
+static uint64_t started;
+
+static const char * const PHASE_NAMES[STATS_PHASES] = {
+	"read", "date", "scan", "write", "replace", "times"
+};
+
+static uint64_t now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static struct stats_block *localBlock(void) {
+	if (!local) {
+		local = calloc(1, sizeof(struct stats_block));
+		if (!local) return NULL;
+
+		pthread_mutex_lock(&blocksLock);
+		local->next = blocks;
+		blocks = local;
+		pthread_mutex_unlock(&blocksLock);
+	}
+	return local;
+}
+
+void statsStart(void) {
+	statsEnabled = 1;
+	started = now();
+}
+
+void statsEnter(enum stats_phase phase) {
+	traceBegin(PHASE_NAMES[phase], NULL);
+	if (!statsEnabled) return;
+
+	struct stats_block *block = localBlock();
+	if (!block || block->depth == STATS_MAX_DEPTH) return;
+
+	int saved = errno;
+	uint64_t time = now();
+	if (block->depth > 0) {
+		block->phaseTime[block->stack[block->depth - 1]] += time - block->since;
+	}
+	block->stack[block->depth++] = phase;
+	block->since = time;
+	errno = saved;
+}
+
+void statsLeave(void) {
+	traceEnd();
+	if (!statsEnabled) return;
+
+	struct stats_block *block = localBlock();
+	if (!block || block->depth == 0) return;
+
+	int saved = errno;
+	uint64_t time = now();
+	block->phaseTime[block->stack[--block->depth]] += time - block->since;
+	block->since = time;
+	errno = saved;
+}
+
+void statsCount(enum stats_counter counter, uint64_t amount) {
+	if (!statsEnabled) return;
+
+	struct stats_block *block = localBlock();
+	if (block) block->counters[counter] += amount;
+}
+
+void statsReport(FILE *output) {
+	if (!statsEnabled) return;
+
+	uint64_t phaseTime[STATS_PHASES];
+	uint64_t counters[STATS_COUNTERS];
+	memset(phaseTime, 0, sizeof(phaseTime));
+	memset(counters, 0, sizeof(counters));
+
+	pthread_mutex_lock(&blocksLock);
+	int threads = 0;
+	for (struct stats_block *block = blocks; block; block = block->next) {
+		for (int i = 0; i < STATS_PHASES; ++i) phaseTime[i] += block->phaseTime[i];
+		for (int i = 0; i < STATS_COUNTERS; ++i) counters[i] += block->counters[i];
+		++threads;
+	}
+	pthread_mutex_unlock(&blocksLock);
+
+	uint64_t files = 0;
+	for (int i = STATS_FILES_C; i <= STATS_FILES_UNKNOWN; ++i) files += counters[i];
+
+	fprintf(output, "Files: %llu (c %llu, sh %llu, makefile %llu, tex %llu, unknown %llu)\n",
+		(unsigned long long)files,
+		(unsigned long long)counters[STATS_FILES_C],
+		(unsigned long long)counters[STATS_FILES_SH],
+		(unsigned long long)counters[STATS_FILES_MAKEFILE],
+		(unsigned long long)counters[STATS_FILES_TEX],
+		(unsigned long long)counters[STATS_FILES_UNKNOWN]);
+	fprintf(output, "Headers: %llu added, %llu modified, %llu skipped\n",
+		(unsigned long long)counters[STATS_ADDED],
+		(unsigned long long)counters[STATS_MODIFIED],
+		(unsigned long long)counters[STATS_SKIPPED]);
+	fprintf(output, "Bytes: %llu read, %llu written\n",
+		(unsigned long long)counters[STATS_BYTES_READ],
+		(unsigned long long)counters[STATS_BYTES_WRITTEN]);
+
+	fprintf(output, "Time: %.3f ms wall, phases summed over %d thread%s:",
+		(now() - started) / 1e6, threads, (threads == 1 ? "" : "s"));
+	for (int i = 0; i < STATS_PHASES; ++i) {
+		fprintf(output, "%s %s %.3f ms", (i == 0 ? "" : ","), PHASE_NAMES[i], phaseTime[i] / 1e6);
+	}
+	fprintf(output, "\n");
+}
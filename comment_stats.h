@@ -0,0 +1,44 @@
+/**
+ * @file comment_stats.h
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#ifndef COMMENT_STATS_H
+#define COMMENT_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+enum stats_phase {
+	STATS_READ,
+	STATS_DATE,
+	STATS_SCAN,
+	STATS_WRITE,
+	STATS_REPLACE,
+	STATS_TIMES,
+	STATS_PHASES
+};
+
+enum stats_counter {
+	STATS_FILES_C,
+	STATS_FILES_SH,
+	STATS_FILES_MAKEFILE,
+	STATS_FILES_TEX,
+	STATS_FILES_UNKNOWN,
+	STATS_ADDED,
+	STATS_MODIFIED,
+	STATS_SKIPPED,
+	STATS_BYTES_READ,
+	STATS_BYTES_WRITTEN,
+	STATS_COUNTERS
+};
+
+extern int statsEnabled;
+
+void statsStart(void);
+void statsEnter(enum stats_phase phase);
+void statsLeave(void);
+void statsCount(enum stats_counter counter, uint64_t amount);
+void statsReport(FILE *output);
+
+#endif
@@ -1,12 +1,15 @@
 /**
  * @file comment_tex.h
  * @author Anders Tornblad
- * @date 2017-08-24
+ * @date 2026-10-18
  */
 #ifndef COMMENT_TEX_H
 #define COMMENT_TEX_H
 
 #include "comment.h"
+#include "comment_line.h"
+
+extern const LINE_SYNTAX TEX_SYNTAX;
 
 int commentTex(COMMENT *data);
 
@@ -0,0 +1,213 @@
+/**
+ * @file comment_trace.c
+ * @brief span recording for --trace, written as Chrome trace event JSON
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "comment_trace.h"
+
+/* RECORDING
+ * Every thread gets a ring of events before it records anything: the main
+ * thread when the trace is opened, and each pool worker when it starts, so
+ * the allocation isn't part of the first span. A thread that wasn't set up
+ * (one of a library user's, say) gets its ring with its first event. A span
+ * is stored as one complete event when it ends, so recording is two clock
+ * reads and a copy into memory that is already there. When a ring is
+ * full the oldest events are overwritten, and the number of lost events is
+ * written to the trace. Only the end of a long detail (usually a path) is
+ * kept, since that is the part that tells files apart.
+ *
+ * The rings are written out by traceClose(), after all workers are done. The
+ * output can be loaded into chrome://tracing or ui.perfetto.dev.
+ */
+
+#define TRACE_EVENTS_PER_THREAD 32768
+#define TRACE_MAX_DEPTH 16
+#define TRACE_DETAIL_SIZE 104
+
+struct trace_event {
+	const char *name;
+	uint64_t start;
+	uint64_t duration;
+	char detail[TRACE_DETAIL_SIZE];
+};
+
+struct trace_open {
+	const char *name;
+	const char *detail;
+	uint64_t start;
+};
+
+struct trace_ring {
+	struct trace_event *events;
+	uint64_t written;
+	struct trace_open stack[TRACE_MAX_DEPTH];
+	int depth;
+	long tid;
+	struct trace_ring *next;
+};
+
+int traceEnabled;
+
+static FILE *output;
+static uint64_t started;
+static pthread_mutex_t ringsLock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_ring *rings;
+static __thread struct trace_ring *local;
+
+static uint64_t now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static struct trace_ring *localRing(void) {
+	if (!local) {
+		struct trace_ring *ring = calloc(1, sizeof(struct trace_ring));
+		if (!ring) return NULL;
+
+		ring->events = malloc(TRACE_EVENTS_PER_THREAD * sizeof(struct trace_event));
+		if (!ring->events) {
+			free(ring);
+			return NULL;
+		}
+		ring->tid = (long)syscall(SYS_gettid);
+
+		pthread_mutex_lock(&ringsLock);
+		ring->next = rings;
+		rings = ring;
+		pthread_mutex_unlock(&ringsLock);
+
+		local = ring;
+	}
+	return local;
+}
+
+/* Sets up the calling thread's ring, ahead of its first event */
+void traceThread(void) {
+	if (traceEnabled) localRing();
+}
+
+int traceOpen(const char *filename) {
+	output = fopen(filename, "w");
+	if (!output) return -1;
+
+	started = now();
+	traceEnabled = 1;
+	traceThread();
+	return 0;
+}
+
+/* The detail, if any, must stay valid until the matching traceEnd() */
+void traceBegin(const char *name, const char *detail) {
+	if (!traceEnabled) return;
+
+	struct trace_ring *ring = localRing();
+	if (!ring) return;
+
+	if (ring->depth < TRACE_MAX_DEPTH) {
+		int saved = errno;
+		struct trace_open *open = &ring->stack[ring->depth];
+		open->name = name;
+		open->detail = detail;
+		open->start = now();
+		errno = saved;
+	}
+	++ring->depth;
+}
+
+void traceEnd(void) {
+	if (!traceEnabled || !local || local->depth == 0) return;
+
+	struct trace_ring *ring = local;
+	if (--ring->depth >= TRACE_MAX_DEPTH) return;
+
+	int saved = errno;
+	struct trace_open *open = &ring->stack[ring->depth];
+	struct trace_event *event = &ring->events[ring->written++ % TRACE_EVENTS_PER_THREAD];
+	event->name = open->name;
+	event->start = open->start;
+	event->duration = now() - open->start;
+
+	if (open->detail) {
+		size_t length = strlen(open->detail);
+		const char *tail = (length >= TRACE_DETAIL_SIZE) ? open->detail + length - (TRACE_DETAIL_SIZE - 1) : open->detail;
+		while ((*tail & 0xc0) == 0x80) ++tail;
+		strcpy(event->detail, tail);
+	}
+	else {
+		event->detail[0] = '\0';
+	}
+	errno = saved;
+}
+
+static void writeString(const char *text) {
+	fputc('"', output);
+	for (const unsigned char *p = (const unsigned char *)text; *p; ++p) {
+		if (*p == '"' || *p == '\\') fprintf(output, "\\%c", *p);
+		else if (*p < 0x20) fprintf(output, "\\u%04x", *p);
+		else fputc(*p, output);
+	}
+	fputc('"', output);
+}
+
+int traceClose(void) {
+	if (!traceEnabled) return 0;
+	traceEnabled = 0;
+
+	int pid = (int)getpid();
+	int first = 1;
+	uint64_t dropped = 0;
+
+	fprintf(output, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	pthread_mutex_lock(&ringsLock);
+	for (struct trace_ring *ring = rings; ring; ring = ring->next) {
+		uint64_t begin = 0;
+		if (ring->written > TRACE_EVENTS_PER_THREAD) {
+			begin = ring->written - TRACE_EVENTS_PER_THREAD;
+			dropped += begin;
+		}
+
+		for (uint64_t i = begin; i < ring->written; ++i) {
+			const struct trace_event *event = &ring->events[i % TRACE_EVENTS_PER_THREAD];
+			fprintf(output, "%s{\"name\":\"%s\",\"cat\":\"comment\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%ld",
+				(first ? "" : ",\n"), event->name,
+				(event->start - started) / 1e3, event->duration / 1e3, pid, ring->tid);
+			if (event->detail[0] != '\0') {
+				fprintf(output, ",\"args\":{\"path\":");
+				writeString(event->detail);
+				fprintf(output, "}");
+			}
+			fprintf(output, "}");
+			first = 0;
+		}
+	}
+
+	struct trace_ring *ring = rings;
+	while (ring) {
+		struct trace_ring *next = ring->next;
+		free(ring->events);
+		free(ring);
+		ring = next;
+	}
+	rings = NULL;
+	local = NULL;
+	pthread_mutex_unlock(&ringsLock);
+
+	fprintf(output, "\n],\"otherData\":{\"droppedEvents\":%llu}}\n", (unsigned long long)dropped);
+
+	int result = (fclose(output) == 0) ? 0 : -1;
+	output = NULL;
+	return result;
+}
@@ -0,0 +1,17 @@
+/**
+ * @file comment_trace.h
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#ifndef COMMENT_TRACE_H
+#define COMMENT_TRACE_H
+
+extern int traceEnabled;
+
+int traceOpen(const char *filename);
+void traceThread(void);
+void traceBegin(const char *name, const char *detail);
+void traceEnd(void);
+int traceClose(void);
+
+#endif
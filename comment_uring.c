@@ -0,0 +1,358 @@
+/**
+ * @file comment_uring.c
+ * @brief batched opening and reading of files through io_uring
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <linux/io_uring.h>
+#include "comment_uring.h"
+#include "comment_stats.h"
+
+/* BATCHING
+ * Stamping a long list of small files is mostly syscalls: stat, open, read
+ * and close for every file, before any handler has looked at a byte. Here
+ * that work is done for a whole batch of files at a time, with three trips
+ * to the kernel. The first submission opens every file in the batch, the
+ * second one stat's each file that could be opened, and the third one reads
+ * its first block. The stat goes through the open descriptor, not the path,
+ * so it describes the very file that is read, even if an editor saved over
+ * the path in between.
+ *
+ * There is no liburing dependency, the rings are set up with the raw
+ * syscalls. When the kernel doesn't have io_uring (or it is disabled), no
+ * ring is created and the files are opened one at a time like before. A
+ * file whose operations fail in the ring is also just left to the normal
+ * path, which then reports any error the usual way.
+ *
+ * If entering the ring fails, the entries the kernel never saw are taken
+ * back and the ones it did are waited for, so no completion is left over
+ * to be matched with the wrong file in the next batch. If even that wait
+ * fails, the ring is given up on, and the rest of the files all take the
+ * normal path.
+ */
+
+#define URING_ENTRIES (2 * URING_BATCH)
+
+struct comment_uring {
+	int fd;
+
+	void *sqRing;
+	size_t sqRingSize;
+	void *cqRing;
+	size_t cqRingSize;
+	struct io_uring_sqe *sqes;
+	size_t sqesSize;
+
+	unsigned *sqTail;
+	unsigned *sqMask;
+	unsigned *sqArray;
+	unsigned *cqHead;
+	unsigned *cqTail;
+	unsigned *cqMask;
+	struct io_uring_cqe *cqes;
+
+	unsigned pending;
+	int broken;
+};
+
+static int uringSetup(unsigned entries, struct io_uring_params *params) {
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uringEnter(int fd, unsigned submit, unsigned wait) {
+	return (int)syscall(__NR_io_uring_enter, fd, submit, wait, (wait ? IORING_ENTER_GETEVENTS : 0), NULL, 0);
+}
+
+URING *uringCreate(void) {
+	URING *ring = calloc(1, sizeof(URING));
+	if (!ring) return NULL;
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	ring->fd = uringSetup(URING_ENTRIES, &params);
+	if (ring->fd < 0) {
+		free(ring);
+		return NULL;
+	}
+
+	ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) && ring->cqRingSize > ring->sqRingSize) {
+		ring->sqRingSize = ring->cqRingSize;
+	}
+
+	ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sqRing == MAP_FAILED) {
+		ring->sqRing = NULL;
+		uringDestroy(ring);
+		return NULL;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cqRing = ring->sqRing;
+	}
+	else {
+		ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cqRing == MAP_FAILED) {
+			ring->cqRing = NULL;
+			uringDestroy(ring);
+			return NULL;
+		}
+	}
+
+	ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		uringDestroy(ring);
+		return NULL;
+	}
+
+	char *sq = ring->sqRing;
+	ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+	ring->sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+	ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+
+	char *cq = ring->cqRing;
+	ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+	ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+	ring->cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+	return ring;
+}
+
+void uringDestroy(URING *ring) {
+	if (!ring) return;
+
+	if (ring->sqes) munmap(ring->sqes, ring->sqesSize);
+	if (ring->cqRing && ring->cqRing != ring->sqRing) munmap(ring->cqRing, ring->cqRingSize);
+	if (ring->sqRing) munmap(ring->sqRing, ring->sqRingSize);
+	close(ring->fd);
+	free(ring);
+}
+
+static struct io_uring_sqe *nextEntry(URING *ring, uint64_t userData) {
+	unsigned tail = *ring->sqTail + ring->pending;
+	unsigned index = tail & *ring->sqMask;
+
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = userData;
+	ring->sqArray[index] = index;
+	++ring->pending;
+
+	return sqe;
+}
+
+/* Hands everything queued since the last call to the kernel, and lets done()
+ * see each completion as it arrives. Returns -1 if the kernel didn't take
+ * all of it, but only once every entry it did take has completed. */
+static int submitAndWait(URING *ring, void (*done)(PREFETCH *, uint64_t, int), PREFETCH *files) {
+	unsigned expected = ring->pending;
+	__atomic_store_n(ring->sqTail, *ring->sqTail + ring->pending, __ATOMIC_RELEASE);
+
+	unsigned toSubmit = ring->pending;
+	ring->pending = 0;
+	int failed = 0;
+
+	while (expected > 0) {
+		int result = uringEnter(ring->fd, toSubmit, 1);
+		if (result < 0) {
+			if (errno == EINTR) continue;
+			if (failed) {
+				ring->broken = 1;
+				return -1;
+			}
+
+			/* Without a polling thread the kernel only reads the queue when
+			 * entered, so the entries it didn't take can just be taken back */
+			failed = 1;
+			__atomic_store_n(ring->sqTail, *ring->sqTail - toSubmit, __ATOMIC_RELEASE);
+			expected -= toSubmit;
+			toSubmit = 0;
+			continue;
+		}
+		toSubmit -= (unsigned)result < toSubmit ? (unsigned)result : toSubmit;
+
+		unsigned head = *ring->cqHead;
+		unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+		while (head != tail && expected > 0) {
+			struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cqMask];
+			done(files, cqe->user_data, cqe->res);
+			++head;
+			--expected;
+		}
+		__atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+	}
+
+	return failed ? -1 : 0;
+}
+
+struct open_state {
+	int fd;
+	int statResult;
+	struct statx stx;
+};
+
+static __thread struct open_state opening[URING_BATCH];
+
+#define OP_OPEN 0
+#define OP_STAT 1
+
+static void openDone(PREFETCH *files, uint64_t userData, int result) {
+	struct open_state *state = &opening[userData >> 1];
+	if ((userData & 1) == OP_OPEN) {
+		state->fd = result;
+	}
+	else {
+		state->statResult = result;
+	}
+}
+
+static void readDone(PREFETCH *files, uint64_t userData, int result) {
+	PREFETCH *file = &files[userData];
+	if (result >= 0 && (size_t)result == file->view.length) {
+		file->ready = 1;
+		statsCount(STATS_BYTES_READ, result);
+	}
+}
+
+static void statFromStatx(struct stat *st, const struct statx *stx) {
+	memset(st, 0, sizeof(*st));
+	st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+	st->st_ino = stx->stx_ino;
+	st->st_mode = stx->stx_mode;
+	st->st_nlink = stx->stx_nlink;
+	st->st_uid = stx->stx_uid;
+	st->st_gid = stx->stx_gid;
+	st->st_rdev = makedev(stx->stx_rdev_major, stx->stx_rdev_minor);
+	st->st_size = stx->stx_size;
+	st->st_blksize = stx->stx_blksize;
+	st->st_blocks = stx->stx_blocks;
+	st->st_atim.tv_sec = stx->stx_atime.tv_sec;
+	st->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+	st->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+	st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+	st->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+	st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+
+static int prefetch(URING *ring, int count, PREFETCH *files) {
+	for (int i = 0; i < count; ++i) {
+		PREFETCH *file = &files[i];
+		file->ready = 0;
+		memset(&file->view, 0, sizeof(VIEW));
+		file->view.fd = -1;
+	}
+	if (ring->broken) return -1;
+
+	for (int i = 0; i < count; ++i) {
+		PREFETCH *file = &files[i];
+		opening[i].fd = -1;
+		opening[i].statResult = -1;
+
+		struct io_uring_sqe *sqe = nextEntry(ring, ((uint64_t)i << 1) | OP_OPEN);
+		sqe->opcode = IORING_OP_OPENAT;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (uint64_t)(uintptr_t)file->filename;
+		sqe->open_flags = O_RDONLY | O_CLOEXEC;
+	}
+
+	int result = submitAndWait(ring, openDone, files);
+
+	for (int i = 0; result == 0 && i < count; ++i) {
+		if (opening[i].fd < 0) continue;
+
+		struct io_uring_sqe *sqe = nextEntry(ring, ((uint64_t)i << 1) | OP_STAT);
+		sqe->opcode = IORING_OP_STATX;
+		sqe->fd = opening[i].fd;
+		sqe->addr = (uint64_t)(uintptr_t)"";
+		sqe->statx_flags = AT_EMPTY_PATH;
+		sqe->len = STATX_BASIC_STATS;
+		sqe->off = (uint64_t)(uintptr_t)&opening[i].stx;
+	}
+
+	if (result != 0 || submitAndWait(ring, openDone, files) != 0) {
+		for (int i = 0; i < count; ++i) {
+			if (opening[i].fd >= 0) close(opening[i].fd);
+		}
+		return -1;
+	}
+
+	for (int i = 0; i < count; ++i) {
+		PREFETCH *file = &files[i];
+		struct open_state *state = &opening[i];
+		if (state->fd < 0) continue;
+
+		/* Anything but a plain file is left for the normal path to complain about */
+		if (state->statResult < 0 || !S_ISREG(state->stx.stx_mode)) {
+			close(state->fd);
+			continue;
+		}
+
+		statFromStatx(&file->stat, &state->stx);
+
+		size_t wanted = (file->stat.st_size < VIEW_BLOCK_SIZE) ? (size_t)file->stat.st_size : VIEW_BLOCK_SIZE;
+		file->view.block = malloc(wanted ? wanted : 1);
+		if (!file->view.block) {
+			close(state->fd);
+			continue;
+		}
+
+		file->view.fd = state->fd;
+		file->view.data = file->view.block;
+		file->view.length = wanted;
+		file->view.size = file->stat.st_size;
+
+		if (wanted == 0) {
+			file->ready = 1;
+			continue;
+		}
+
+		struct io_uring_sqe *sqe = nextEntry(ring, (uint64_t)i);
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = state->fd;
+		sqe->addr = (uint64_t)(uintptr_t)file->view.block;
+		sqe->len = (unsigned)wanted;
+		sqe->off = 0;
+	}
+
+	result = submitAndWait(ring, readDone, files);
+
+	for (int i = 0; i < count; ++i) {
+		if (files[i].ready || files[i].view.fd < 0) continue;
+
+		/* A read that the kernel may still be doing keeps its buffer */
+		if (ring->broken) files[i].view.block = NULL;
+		viewClose(&files[i].view);
+	}
+
+	return result;
+}
+
+/* Opens, stat's and reads the first block of up to URING_BATCH files. Files
+ * that end up with ready set can be used as they are, the rest are left
+ * closed for the caller to open the usual way */
+int uringPrefetch(URING *ring, int count, PREFETCH *files) {
+	if (count > URING_BATCH) count = URING_BATCH;
+
+	statsEnter(STATS_READ);
+	int result = prefetch(ring, count, files);
+	statsLeave();
+	return result;
+}
@@ -0,0 +1,31 @@
+/**
+ * @file comment_uring.h
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#ifndef COMMENT_URING_H
+#define COMMENT_URING_H
+
+#include <sys/stat.h>
+#include "comment_io.h"
+
+/* How many files are opened, stat'ed and read per submission */
+#define URING_BATCH 64
+
+typedef struct comment_uring URING;
+
+/* A file that has already been opened and had its first block read */
+struct comment_prefetch {
+	const char *filename;
+	int ready;
+	struct stat stat;
+	VIEW view;
+};
+
+typedef struct comment_prefetch PREFETCH;
+
+URING *uringCreate(void);
+int uringPrefetch(URING *ring, int count, PREFETCH *files);
+void uringDestroy(URING *ring);
+
+#endif
@@ -0,0 +1,329 @@
+/**
+ * @file comment_walk.c
+ * @brief parallel directory tree walker for recursive mode
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "comment_walk.h"
+#include "comment_jobs.h"
+#include "comment_trace.h"
+
+/* Every directory is read by its own pool task, using getdents64 on a
+ * descriptor from openat, and every subdirectory found becomes a new task.
+ * Regular files are handed to the visit callback as separate tasks, with
+ * their paths cut from the shared JOBS arena rather than malloc()'ed one by
+ * one. Once WALK_AHEAD files are waiting for a worker, the walking thread
+ * visits the files it finds itself, so a huge tree doesn't pile up in
+ * memory. Hidden entries (.git, .comment-data, ...) and symbolic links are
+ * skipped.
+ *
+ * Each (dev, ino) pair is only visited once, so hard links are stamped once
+ * and bind mounts that loop back into the tree are not walked forever.
+ */
+
+#define WALK_BUFFER_SIZE 32768
+#define WALK_AHEAD 4096
+
+struct walk_seen {
+	dev_t dev;
+	ino_t ino;
+	int used;
+};
+
+struct comment_walk {
+	POOL *pool;
+	WALK_VISIT visit;
+	void *context;
+	pthread_mutex_t lock;
+	struct walk_seen *seen;
+	size_t seenCapacity;
+	size_t seenCount;
+	int errors;
+	JOBS *files;
+	int queued;
+};
+
+struct walk_job {
+	WALK *walk;
+	char *path;
+	dev_t dev;
+};
+
+static size_t seenHash(dev_t dev, ino_t ino) {
+	unsigned long long key = ((unsigned long long)dev * 0x9E3779B97F4A7C15ULL) ^ (unsigned long long)ino;
+	key ^= key >> 29;
+	key *= 0xBF58476D1CE4E5B9ULL;
+	key ^= key >> 32;
+	return (size_t)key;
+}
+
+static void seenInsert(struct walk_seen *table, size_t capacity, dev_t dev, ino_t ino) {
+	size_t slot = seenHash(dev, ino) & (capacity - 1);
+	while (table[slot].used) {
+		slot = (slot + 1) & (capacity - 1);
+	}
+	table[slot].dev = dev;
+	table[slot].ino = ino;
+	table[slot].used = 1;
+}
+
+/* Returns 1 the first time a (dev, ino) pair is seen, 0 after that */
+static int markSeen(WALK *walk, dev_t dev, ino_t ino) {
+	pthread_mutex_lock(&walk->lock);
+
+	size_t slot = seenHash(dev, ino) & (walk->seenCapacity - 1);
+	while (walk->seen[slot].used) {
+		if (walk->seen[slot].dev == dev && walk->seen[slot].ino == ino) {
+			pthread_mutex_unlock(&walk->lock);
+			return 0;
+		}
+		slot = (slot + 1) & (walk->seenCapacity - 1);
+	}
+
+	if ((walk->seenCount + 1) * 2 > walk->seenCapacity) {
+		size_t capacity = walk->seenCapacity * 2;
+		struct walk_seen *table = calloc(capacity, sizeof(struct walk_seen));
+		if (!table) {
+			fprintf(stderr, "Out of memory while walking directories\n");
+			abort();
+		}
+		for (size_t i = 0; i < walk->seenCapacity; ++i) {
+			if (walk->seen[i].used) {
+				seenInsert(table, capacity, walk->seen[i].dev, walk->seen[i].ino);
+			}
+		}
+		free(walk->seen);
+		walk->seen = table;
+		walk->seenCapacity = capacity;
+	}
+
+	seenInsert(walk->seen, walk->seenCapacity, dev, ino);
+	++walk->seenCount;
+
+	pthread_mutex_unlock(&walk->lock);
+	return 1;
+}
+
+static void walkError(WALK *walk, const char *message, const char *path) {
+	fprintf(stderr, "%s '%s': %s\n", message, path, strerror(errno));
+	pthread_mutex_lock(&walk->lock);
+	++walk->errors;
+	pthread_mutex_unlock(&walk->lock);
+}
+
+/* Joins into *buffer, which is grown as needed and reused for the next name */
+static size_t joinPath(const char *directory, const char *name, char **buffer, size_t *capacity) {
+	size_t dirlen = strlen(directory);
+	size_t namelen = strlen(name);
+	if (dirlen + namelen + 2 > *capacity) {
+		size_t grown = (dirlen + namelen + 2) * 2;
+		char *path = realloc(*buffer, grown);
+		if (!path) {
+			fprintf(stderr, "Out of memory while walking directories\n");
+			abort();
+		}
+		*buffer = path;
+		*capacity = grown;
+	}
+
+	char *path = *buffer;
+	memcpy(path, directory, dirlen);
+	if (dirlen == 0 || directory[dirlen - 1] != '/') {
+		path[dirlen++] = '/';
+	}
+	memcpy(&path[dirlen], name, namelen + 1);
+	return dirlen + namelen;
+}
+
+static void visitFile(void *arg) {
+	JOB *job = (JOB *)arg;
+	WALK *walk = (WALK *)job->user;
+	walk->visit(job->path, walk->context);
+	jobsDone(walk->files, job);
+}
+
+static void visitQueuedFile(void *arg) {
+	WALK *walk = (WALK *)((JOB *)arg)->user;
+	visitFile(arg);
+	__atomic_sub_fetch(&walk->queued, 1, __ATOMIC_RELAXED);
+}
+
+static void submitFile(WALK *walk, const char *path, size_t length) {
+	JOB *job = jobsAdd(walk->files, path, length);
+	if (!job) {
+		fprintf(stderr, "Out of memory while walking directories\n");
+		abort();
+	}
+	job->user = walk;
+
+	if (__atomic_load_n(&walk->queued, __ATOMIC_RELAXED) >= WALK_AHEAD) {
+		visitFile(job);
+		return;
+	}
+	__atomic_add_fetch(&walk->queued, 1, __ATOMIC_RELAXED);
+	poolSubmit(walk->pool, visitQueuedFile, job);
+}
+
+static void walkDirectory(void *arg);
+
+static void submitJob(WALK *walk, char *path, dev_t dev, POOL_TASK task) {
+	struct walk_job *job = malloc(sizeof(struct walk_job));
+	if (!job) {
+		fprintf(stderr, "Out of memory while walking directories\n");
+		abort();
+	}
+	job->walk = walk;
+	job->path = path;
+	job->dev = dev;
+	poolSubmit(walk->pool, task, job);
+}
+
+static void walkDirectory(void *arg) {
+	struct walk_job *job = (struct walk_job *)arg;
+	WALK *walk = job->walk;
+	traceBegin("directory", job->path);
+
+	int fd = openat(AT_FDCWD, job->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		walkError(walk, "Could not open directory", job->path);
+		traceEnd();
+		free(job->path);
+		free(job);
+		return;
+	}
+
+	char *buffer = malloc(WALK_BUFFER_SIZE);
+	if (!buffer) {
+		fprintf(stderr, "Out of memory while walking directories\n");
+		abort();
+	}
+	char *joined = NULL;
+	size_t joinedCapacity = 0;
+
+	ssize_t length;
+	while ((length = getdents64(fd, buffer, WALK_BUFFER_SIZE)) > 0) {
+		for (ssize_t offset = 0; offset < length; ) {
+			struct dirent64 *entry = (struct dirent64 *)&buffer[offset];
+			offset += entry->d_reclen;
+
+			if (entry->d_name[0] == '.') continue;
+
+			unsigned char type = entry->d_type;
+			dev_t dev = job->dev;
+			ino_t ino = entry->d_ino;
+
+			/* Directories may be mount points, so their real (dev, ino) needs a stat */
+			if (type == DT_DIR || type == DT_UNKNOWN) {
+				struct stat st;
+				if (fstatat(fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+
+				if (S_ISDIR(st.st_mode)) type = DT_DIR;
+				else if (S_ISREG(st.st_mode)) type = DT_REG;
+				else continue;
+
+				dev = st.st_dev;
+				ino = st.st_ino;
+			}
+
+			if (type != DT_DIR && type != DT_REG) continue;
+			if (!markSeen(walk, dev, ino)) continue;
+
+			size_t pathLength = joinPath(job->path, entry->d_name, &joined, &joinedCapacity);
+			if (type == DT_REG) {
+				submitFile(walk, joined, pathLength);
+				continue;
+			}
+
+			char *path = strdup(joined);
+			if (!path) {
+				fprintf(stderr, "Out of memory while walking directories\n");
+				abort();
+			}
+			submitJob(walk, path, dev, walkDirectory);
+		}
+	}
+
+	if (length < 0) {
+		walkError(walk, "Could not read directory", job->path);
+	}
+
+	free(joined);
+	free(buffer);
+	close(fd);
+	traceEnd();
+	free(job->path);
+	free(job);
+}
+
+WALK *walkCreate(POOL *pool, WALK_VISIT visit, void *context) {
+	WALK *walk = calloc(1, sizeof(WALK));
+	if (!walk) return NULL;
+
+	walk->seenCapacity = 1024;
+	walk->seen = calloc(walk->seenCapacity, sizeof(struct walk_seen));
+	walk->files = jobsCreate();
+	if (!walk->seen || !walk->files) {
+		jobsDestroy(walk->files);
+		free(walk->seen);
+		free(walk);
+		return NULL;
+	}
+
+	walk->pool = pool;
+	walk->visit = visit;
+	walk->context = context;
+	pthread_mutex_init(&walk->lock, NULL);
+
+	return walk;
+}
+
+int walkAdd(WALK *walk, const char *root) {
+	struct stat st;
+	if (stat(root, &st) != 0) {
+		walkError(walk, "Could not find directory", root);
+		return 1;
+	}
+
+	if (!S_ISDIR(st.st_mode)) {
+		errno = ENOTDIR;
+		walkError(walk, "Could not walk", root);
+		return 1;
+	}
+
+	if (!markSeen(walk, st.st_dev, st.st_ino)) return 0;
+
+	char *path = strdup(root);
+	if (!path) {
+		fprintf(stderr, "Out of memory while walking directories\n");
+		abort();
+	}
+	submitJob(walk, path, st.st_dev, walkDirectory);
+	return 0;
+}
+
+int walkErrors(WALK *walk) {
+	pthread_mutex_lock(&walk->lock);
+	int errors = walk->errors;
+	pthread_mutex_unlock(&walk->lock);
+	return errors;
+}
+
+void walkDestroy(WALK *walk) {
+	if (!walk) return;
+
+	jobsDestroy(walk->files);
+	pthread_mutex_destroy(&walk->lock);
+	free(walk->seen);
+	free(walk);
+}
@@ -0,0 +1,20 @@
+/**
+ * @file comment_walk.h
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#ifndef COMMENT_WALK_H
+#define COMMENT_WALK_H
+
+#include "comment_pool.h"
+
+typedef void (*WALK_VISIT)(const char *path, void *context);
+
+typedef struct comment_walk WALK;
+
+WALK *walkCreate(POOL *pool, WALK_VISIT visit, void *context);
+int walkAdd(WALK *walk, const char *root);
+int walkErrors(WALK *walk);
+void walkDestroy(WALK *walk);
+
+#endif
@@ -0,0 +1,329 @@
+/**
+ * @file comment_watch.c
+ * @brief stamps files in directory trees as they are saved, using inotify
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <ftw.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "comment_watch.h"
+
+/* WATCHING
+ * Every directory in the trees gets an inotify watch for files that are
+ * closed after writing or moved in, and for new subdirectories, which are
+ * then watched (and their files stamped) as well. Hidden entries are
+ * skipped, like when walking with -r.
+ *
+ * Touched files are collected until nothing has happened for
+ * WATCH_DEBOUNCE_MS, so an editor or generator saving in bursts only leads
+ * to each file being stamped once. A steady stream of changes still gets
+ * flushed every WATCH_MAX_DELAY_MS.
+ *
+ * Stamping a file causes events of its own: a rename over the original, or
+ * a close after patching the date in place, and the times being put back.
+ * After a file has been handled its metadata is remembered, including the
+ * ctime, which moves on every write and every utime(). An event for a file
+ * that still looks exactly like that is ours, and is ignored.
+ */
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+#define WATCH_MAX_DELAY_MS (10 * WATCH_DEBOUNCE_MS)
+#define WATCH_BUFFER_SIZE 65536
+#define WATCH_OWN_SLOTS 4096
+
+struct watch_own {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	struct timespec ctime;
+};
+
+struct watch_state {
+	int fd;
+	char **directories;
+	int directoryCapacity;
+	int directoryCount;
+	char **pending;
+	size_t pendingCount;
+	size_t pendingCapacity;
+	int queueFiles;
+	struct watch_own own[WATCH_OWN_SLOTS];
+	WATCH_VISIT visit;
+	void *context;
+};
+
+/* nftw() has no context argument, and there is only ever one watch */
+static struct watch_state watch;
+static volatile sig_atomic_t stopping;
+
+static void stop(int signal) {
+	stopping = 1;
+}
+
+static char *joinPath(const char *directory, const char *name) {
+	size_t directoryLength = strlen(directory);
+	size_t nameLength = strlen(name);
+	char *path = malloc(directoryLength + nameLength + 2);
+	if (!path) return NULL;
+
+	memcpy(path, directory, directoryLength);
+	path[directoryLength] = '/';
+	memcpy(&path[directoryLength + 1], name, nameLength + 1);
+	return path;
+}
+
+static void queuePath(const char *path) {
+	if (watch.pendingCount == watch.pendingCapacity) {
+		size_t capacity = watch.pendingCapacity ? watch.pendingCapacity * 2 : 256;
+		char **pending = realloc(watch.pending, capacity * sizeof(char *));
+		if (!pending) return;
+		watch.pending = pending;
+		watch.pendingCapacity = capacity;
+	}
+
+	char *copy = strdup(path);
+	if (copy) watch.pending[watch.pendingCount++] = copy;
+}
+
+static void addDirectory(const char *path) {
+	int wd = inotify_add_watch(watch.fd, path, WATCH_MASK);
+	if (wd < 0) {
+		fprintf(stderr, "Could not watch directory '%s': %s\n", path, strerror(errno));
+		if (errno == ENOSPC) {
+			fprintf(stderr, "The limit is set in /proc/sys/fs/inotify/max_user_watches\n");
+		}
+		return;
+	}
+
+	if (wd >= watch.directoryCapacity) {
+		int capacity = watch.directoryCapacity ? watch.directoryCapacity : 256;
+		while (capacity <= wd) capacity *= 2;
+		char **directories = realloc(watch.directories, capacity * sizeof(char *));
+		if (!directories) return;
+		memset(&directories[watch.directoryCapacity], 0, (capacity - watch.directoryCapacity) * sizeof(char *));
+		watch.directories = directories;
+		watch.directoryCapacity = capacity;
+	}
+
+	if (!watch.directories[wd]) ++watch.directoryCount;
+	free(watch.directories[wd]);
+	watch.directories[wd] = strdup(path);
+}
+
+static int addEntry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+	if (ftw->level > 0 && path[ftw->base] == '.') {
+		return (flag == FTW_D) ? FTW_SKIP_SUBTREE : FTW_CONTINUE;
+	}
+
+	if (flag == FTW_D) {
+		addDirectory(path);
+	}
+	else if (flag == FTW_F && watch.queueFiles && S_ISREG(st->st_mode)) {
+		queuePath(path);
+	}
+
+	return FTW_CONTINUE;
+}
+
+/* Watches every directory in the tree, and queues the files already in it
+ * if the directory just appeared */
+static void addTree(const char *root, int queueFiles) {
+	watch.queueFiles = queueFiles;
+	nftw(root, addEntry, 32, FTW_PHYS | FTW_ACTIONRETVAL);
+}
+
+static struct watch_own *ownSlot(const char *path) {
+	size_t hash = 5381;
+	for (const char *p = path; *p; ++p) hash = hash * 33 + (unsigned char)*p;
+	return &watch.own[hash % WATCH_OWN_SLOTS];
+}
+
+static int sameTime(const struct timespec *a, const struct timespec *b) {
+	return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+static int isUnchanged(const char *path, const struct stat *st) {
+	struct watch_own *own = ownSlot(path);
+	return own->path && strcmp(own->path, path) == 0 &&
+		own->dev == st->st_dev && own->ino == st->st_ino && own->size == st->st_size &&
+		sameTime(&own->mtime, &st->st_mtim) && sameTime(&own->ctime, &st->st_ctim);
+}
+
+static void remember(const char *path) {
+	struct stat st;
+	if (stat(path, &st) != 0) return;
+
+	struct watch_own *own = ownSlot(path);
+	if (!own->path || strcmp(own->path, path) != 0) {
+		free(own->path);
+		own->path = strdup(path);
+	}
+	own->dev = st.st_dev;
+	own->ino = st.st_ino;
+	own->size = st.st_size;
+	own->mtime = st.st_mtim;
+	own->ctime = st.st_ctim;
+}
+
+static int comparePaths(const void *a, const void *b) {
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void flushPending(void) {
+	qsort(watch.pending, watch.pendingCount, sizeof(char *), comparePaths);
+
+	for (size_t i = 0; i < watch.pendingCount; ++i) {
+		const char *path = watch.pending[i];
+		if (i > 0 && strcmp(path, watch.pending[i - 1]) == 0) continue;
+
+		struct stat st;
+		if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+		if (isUnchanged(path, &st)) continue;
+
+		watch.visit(path, watch.context);
+		remember(path);
+	}
+
+	for (size_t i = 0; i < watch.pendingCount; ++i) {
+		free(watch.pending[i]);
+	}
+	watch.pendingCount = 0;
+}
+
+static void readEvents(void) {
+	char buffer[WATCH_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+	ssize_t length = read(watch.fd, buffer, sizeof(buffer));
+	if (length <= 0) return;
+
+	for (ssize_t offset = 0; offset < length; ) {
+		const struct inotify_event *event = (const struct inotify_event *)&buffer[offset];
+		offset += sizeof(struct inotify_event) + event->len;
+
+		if (event->mask & IN_Q_OVERFLOW) {
+			fprintf(stderr, "Too many changes at once, some files may not have been stamped\n");
+			continue;
+		}
+
+		if (event->wd < 0 || event->wd >= watch.directoryCapacity || !watch.directories[event->wd]) continue;
+
+		if (event->mask & IN_IGNORED) {
+			free(watch.directories[event->wd]);
+			watch.directories[event->wd] = NULL;
+			--watch.directoryCount;
+			continue;
+		}
+
+		if (event->len == 0 || event->name[0] == '.') continue;
+
+		char *path = joinPath(watch.directories[event->wd], event->name);
+		if (!path) continue;
+
+		if (event->mask & IN_ISDIR) {
+			if (event->mask & (IN_CREATE | IN_MOVED_TO)) addTree(path, 1);
+		}
+		else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+			queuePath(path);
+		}
+
+		free(path);
+	}
+}
+
+static long long milliseconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Watches the trees until SIGINT or SIGTERM, handing every saved file to
+ * visit() once things have calmed down */
+int watchRun(int count, char **roots, WATCH_VISIT visit, void *context) {
+	memset(&watch, 0, sizeof(watch));
+	watch.visit = visit;
+	watch.context = context;
+
+	for (int i = 0; i < count; ++i) {
+		struct stat st;
+		if (stat(roots[i], &st) != 0 || !S_ISDIR(st.st_mode)) {
+			fprintf(stderr, "Can only watch directories: '%s'\n", roots[i]);
+			return 2;
+		}
+	}
+
+	watch.fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if (watch.fd < 0) {
+		fprintf(stderr, "Could not start watching: %s\n", strerror(errno));
+		return 2;
+	}
+
+	for (int i = 0; i < count; ++i) {
+		addTree(roots[i], 0);
+	}
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = stop;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	fprintf(stdout, "Watching %d director%s, stop with Ctrl+C\n", watch.directoryCount, (watch.directoryCount == 1 ? "y" : "ies"));
+	fflush(stdout);
+
+	long long firstPending = 0;
+	while (!stopping) {
+		int timeout = -1;
+		if (watch.pendingCount > 0) {
+			long long left = firstPending + WATCH_MAX_DELAY_MS - milliseconds();
+			timeout = (left >= WATCH_DEBOUNCE_MS) ? WATCH_DEBOUNCE_MS : (left > 0 ? (int)left : 0);
+		}
+
+		struct pollfd pfd;
+		pfd.fd = watch.fd;
+		pfd.events = POLLIN;
+		int ready = poll(&pfd, 1, timeout);
+		if (ready < 0 && errno == EINTR) continue;
+		if (ready < 0) {
+			fprintf(stderr, "Could not wait for changes: %s\n", strerror(errno));
+			break;
+		}
+
+		if (ready > 0) {
+			readEvents();
+			if (watch.pendingCount > 0 && firstPending == 0) firstPending = milliseconds();
+		}
+
+		if (watch.pendingCount > 0 && (ready == 0 || milliseconds() - firstPending >= WATCH_MAX_DELAY_MS)) {
+			flushPending();
+			firstPending = 0;
+		}
+	}
+
+	flushPending();
+
+	close(watch.fd);
+	for (int i = 0; i < watch.directoryCapacity; ++i) {
+		free(watch.directories[i]);
+	}
+	free(watch.directories);
+	free(watch.pending);
+	for (int i = 0; i < WATCH_OWN_SLOTS; ++i) {
+		free(watch.own[i].path);
+	}
+
+	return 0;
+}
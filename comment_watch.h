@@ -0,0 +1,16 @@
+/**
+ * @file comment_watch.h
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#ifndef COMMENT_WATCH_H
+#define COMMENT_WATCH_H
+
+/* How long a directory tree has to be quiet before touched files are stamped */
+#define WATCH_DEBOUNCE_MS 200
+
+typedef void (*WATCH_VISIT)(const char *path, void *context);
+
+int watchRun(int count, char **roots, WATCH_VISIT visit, void *context);
+
+#endif
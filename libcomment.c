@@ -0,0 +1,456 @@
+/**
+ * @file libcomment.c
+ * @brief stamping files through a context, for the command line and for embedding
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "libcomment.h"
+#include "comment.h"
+#include "comment_cache.h"
+#include "comment_stats.h"
+#include "comment_trace.h"
+#include "comment_date.h"
+#include "comment_c.h"
+#include "comment_makefile.h"
+#include "comment_tex.h"
+#include "comment_sh.h"
+
+/* CONTEXTS
+ * Everything a run needs is in the context: the configuration, the optional
+ * cache and the counters. The configuration is copied in when the context is
+ * created and only read after that, so any number of threads may call
+ * comment_file() on the same context. The counters (and the stale callback)
+ * are behind a lock of their own.
+ *
+ * Dates are rendered through a cache in comment_date.c, so every file
+ * stamped with the same date points at one shared string, which is kept
+ * until the context goes.
+ *
+ * A buffer is stamped just like a file, only from a view of memory, and the
+ * handlers write the whole result to an output buffer rather than to disk.
+ */
+
+struct comment_context {
+	COMMENT_CONFIG config;
+	CACHE *cache;
+	int checkOnly;
+	COMMENT_STALE stale;
+	void *user;
+	pthread_mutex_t lock;
+	COMMENT_COUNTERS counters;
+	DATES *dates;
+};
+
+static const char * const LOCAL_CONFIG_FILENAME = "./.comment-data";
+
+void comment_config_defaults(COMMENT_CONFIG *config) {
+	memset(config, 0, sizeof(COMMENT_CONFIG));
+
+	cuserid(config->author);
+	config->authorIsDefault = 1;
+
+	strcpy(config->dateformat, "%F");
+	config->dateformatIsDefault = 1;
+
+	/* 0 means that the whole file is scanned for an existing date */
+	config->headerwindow = 0;
+	config->headerwindowIsDefault = 1;
+
+	config->cacheEnabled = 0;
+	config->cacheIsDefault = 1;
+
+	/* The ring is only used when the kernel turns out to support it */
+	config->uringEnabled = 1;
+	config->uringIsDefault = 1;
+}
+
+void comment_config_read(COMMENT_CONFIG *config, const char *filename, int global) {
+	FILE *f = fopen(filename, "r");
+	if (!f) return;
+
+	char key[256];
+	char value[256];
+
+	while (fgets(key, 256, f) != NULL) {
+		int len = strlen(key);
+		if (key[len - 1] == '\n') key[len - 1] = '\0';
+
+		if (fgets(value, 256, f) != NULL) {
+			len = strlen(value);
+			if (value[len - 1] == '\n') value[len - 1] = '\0';
+
+			if (strcmp("author", key) == 0) {
+				strcpy(config->author, value);
+				config->authorIsGlobal = global;
+				config->authorIsDefault = 0;
+			}
+			else if (strcmp("dateformat", key) == 0) {
+				strcpy(config->dateformat, value);
+				config->dateformatIsGlobal = global;
+				config->dateformatIsDefault = 0;
+			}
+			else if (strcmp("headerwindow", key) == 0) {
+				config->headerwindow = (off_t)atoll(value);
+				if (config->headerwindow < 0) config->headerwindow = 0;
+				config->headerwindowIsGlobal = global;
+				config->headerwindowIsDefault = 0;
+			}
+			else if (strcmp("cache", key) == 0) {
+				config->cacheEnabled = (strcmp("on", value) == 0 || strcmp("yes", value) == 0 || strcmp("1", value) == 0);
+				config->cacheIsGlobal = global;
+				config->cacheIsDefault = 0;
+			}
+			else if (strcmp("uring", key) == 0) {
+				config->uringEnabled = (strcmp("on", value) == 0 || strcmp("yes", value) == 0 || strcmp("1", value) == 0);
+				config->uringIsGlobal = global;
+				config->uringIsDefault = 0;
+			}
+		}
+		else {
+			break;
+		}
+	}
+
+	fclose(f);
+}
+
+/* The global file is in the user's home, the local one in the working directory */
+int comment_config_filename(int global, char *filename, size_t size) {
+	if (!global) {
+		if (strlen(LOCAL_CONFIG_FILENAME) >= size) return -1;
+		strcpy(filename, LOCAL_CONFIG_FILENAME);
+		return 0;
+	}
+
+	const char *home = getenv("HOME");
+	if (!home) return -1;
+
+	int length = snprintf(filename, size, "%s/.config/comment-data", home);
+	return (length < 0 || (size_t)length >= size) ? -1 : 0;
+}
+
+void comment_config_load(COMMENT_CONFIG *config, int globalOnly) {
+	comment_config_defaults(config);
+
+	char filename[1024];
+	if (comment_config_filename(1, filename, sizeof(filename)) == 0) {
+		comment_config_read(config, filename, 1);
+	}
+
+	if (!globalOnly) {
+		comment_config_read(config, LOCAL_CONFIG_FILENAME, 0);
+	}
+}
+
+COMMENT_CONTEXT *comment_create(const COMMENT_CONFIG *config) {
+	COMMENT_CONTEXT *context = calloc(1, sizeof(COMMENT_CONTEXT));
+	if (!context) return NULL;
+
+	context->config = *config;
+	context->dates = datesCreate(config->dateformat);
+	if (!context->dates) {
+		free(context);
+		return NULL;
+	}
+	pthread_mutex_init(&context->lock, NULL);
+	return context;
+}
+
+/* Nothing is written in check mode. Files that would have been stamped are
+ * counted and passed to stale(), one at a time. */
+void comment_set_check(COMMENT_CONTEXT *context, COMMENT_STALE stale, void *user) {
+	context->checkOnly = 1;
+	context->stale = stale;
+	context->user = user;
+}
+
+/* The cache is only valid for dates stamped with the same settings */
+static unsigned int configFingerprint(const COMMENT_CONFIG *config) {
+	unsigned int hash = 2166136261u;
+	const char *tz = getenv("TZ");
+	const char *parts[3] = { config->author, config->dateformat, (tz ? tz : "") };
+
+	for (int i = 0; i < 3; ++i) {
+		for (const char *p = parts[i]; ; ++p) {
+			hash ^= (unsigned char)*p;
+			hash *= 16777619u;
+			if (*p == '\0') break;
+		}
+	}
+	hash ^= (unsigned int)config->headerwindow;
+	hash *= 16777619u;
+
+	return hash;
+}
+
+int comment_open_cache(COMMENT_CONTEXT *context, const char *filename) {
+	/* Checking never writes anything, not even the cache */
+	if (!context->config.cacheEnabled || context->checkOnly || context->cache) return 0;
+
+	context->cache = cacheOpen(filename, configFingerprint(&context->config));
+	return context->cache ? 0 : -1;
+}
+
+static void countSkipped(COMMENT_CONTEXT *context) {
+	statsCount(STATS_SKIPPED, 1);
+	pthread_mutex_lock(&context->lock);
+	++context->counters.skipped;
+	pthread_mutex_unlock(&context->lock);
+}
+
+static void countStale(COMMENT_CONTEXT *context, const char *filename) {
+	pthread_mutex_lock(&context->lock);
+	++context->counters.stale;
+	if (context->stale) context->stale(filename, context->user);
+	pthread_mutex_unlock(&context->lock);
+}
+
+static int analyzeAndComment(COMMENT *data) {
+	if (strcmp("makefile", data->localname) == 0 ||
+				strcmp("Makefile", data->localname) == 0 ||
+				strcmp(".mk", data->extension) == 0) {
+		statsCount(STATS_FILES_MAKEFILE, 1);
+		return commentMakefile(data);
+	}
+	else if (strcmp(".c", data->extension) == 0 ||
+				strcmp(".h", data->extension) == 0 ||
+				strcmp(".cc", data->extension) == 0 ||
+				strcmp(".cpp", data->extension) == 0 ||
+				strcmp(".c++", data->extension) == 0 ||
+				strcmp(".cxx", data->extension) == 0 ||
+				strcmp(".hh", data->extension) == 0 ||
+				strcmp(".hpp", data->extension) == 0 ||
+				strcmp(".h++", data->extension) == 0) {
+		statsCount(STATS_FILES_C, 1);
+		return commentC(data);
+	}
+	else if(strcmp(".tex", data->extension) == 0) {
+		statsCount(STATS_FILES_TEX, 1);
+		return commentTex(data);
+	}
+	else if(strcmp(".sh", data->extension) == 0) {
+		statsCount(STATS_FILES_SH, 1);
+		return commentSh(data);
+	}
+	else {
+		if (data->view.length >= 2 && data->view.data[0] == '#' && data->view.data[1] == '!') {
+			statsCount(STATS_FILES_SH, 1);
+			return commentSh(data);
+		}
+
+		statsCount(STATS_FILES_UNKNOWN, 1);
+		if (data->discovered) {
+			/* Files found by walking a directory are only stamped if recognized */
+			return 0;
+		}
+		else {
+			fprintf(stderr, "Cannot add comment to: '%s'\nDon't know what type of file it is.\n", data->filename);
+			return 1;
+		}
+	}
+}
+
+/* The language names for comment_buffer(), in place of looking at the file name */
+static int commentAs(COMMENT *data, const char *lang) {
+	if (strcmp("c", lang) == 0) {
+		statsCount(STATS_FILES_C, 1);
+		return commentC(data);
+	}
+	else if (strcmp("makefile", lang) == 0) {
+		statsCount(STATS_FILES_MAKEFILE, 1);
+		return commentMakefile(data);
+	}
+	else if (strcmp("tex", lang) == 0) {
+		statsCount(STATS_FILES_TEX, 1);
+		return commentTex(data);
+	}
+	else if (strcmp("sh", lang) == 0) {
+		statsCount(STATS_FILES_SH, 1);
+		return commentSh(data);
+	}
+	else {
+		fprintf(stderr, "Unknown language '%s', use c, sh, makefile or tex\n", lang);
+		return 2;
+	}
+}
+
+static int formatDate(COMMENT_CONTEXT *context, time_t time, const char **datetext) {
+	statsEnter(STATS_DATE);
+	*datetext = datesFormat(context->dates, time);
+	statsLeave();
+	if (!*datetext) {
+		fprintf(stderr, "Could not format date correctly! Please run comment --config dateformat \"FORMAT\"\n");
+		return 2;
+	}
+	return 0;
+}
+
+/* Fills in the names, and everything from the context */
+static void prepareData(COMMENT_CONTEXT *context, COMMENT *data, const char *filename, int discovered) {
+	const char *lastSlash = strrchr(filename, '/');
+	const char *local = (lastSlash == NULL) ? filename : lastSlash + 1;
+
+	data->discovered = discovered;
+	data->checkOnly = context->checkOnly;
+	data->skipped = 0;
+	data->stale = 0;
+	data->output = NULL;
+	data->filename = filename;
+	data->localname = local;
+	data->author = context->config.author;
+	data->datetext = NULL;
+	data->headerWindow = context->config.headerwindow;
+
+	const char *lastDot = strrchr(local, '.');
+	data->extension = (lastDot == NULL) ? "" : lastDot;
+}
+
+static void countResult(COMMENT_CONTEXT *context, int result) {
+	pthread_mutex_lock(&context->lock);
+	++context->counters.files;
+	if (result > context->counters.result) context->counters.result = result;
+	pthread_mutex_unlock(&context->lock);
+}
+
+static int commentFile(COMMENT_CONTEXT *context, const char *filename, int discovered, VIEW *view, const struct stat *st) {
+	if (filename == NULL) {
+		return 0;
+	}
+
+	CACHE *cache = context->cache;
+	COMMENT data;
+	prepareData(context, &data, filename, discovered);
+	/* Unchanged since it was last stamped, so there is nothing to look for */
+	if (cache && stat(filename, &data.stat) == 0 && cacheIsCurrent(cache, filename, &data.stat)) {
+		if (view) viewClose(view);
+		countSkipped(context);
+		return 0;
+	}
+
+	/* The file is opened once here (or was already, by the caller), and
+	 * every handler works from that view */
+	int found;
+	if (view) {
+		data.view = *view;
+		data.stat = *st;
+		found = 1;
+	}
+	else {
+		found = (viewOpen(filename, &data.view, &data.stat) == 0);
+	}
+
+	if (formatDate(context, data.stat.st_mtime, &data.datetext) != 0) {
+		viewClose(&data.view);
+		return 2;
+	}
+
+	traceBegin("dispatch", NULL);
+	int result = analyzeAndComment(&data);
+	traceEnd();
+	viewClose(&data.view);
+	if (data.skipped) countSkipped(context);
+	if (data.stale) {
+		countStale(context, filename);
+		result = 1;
+	}
+
+	/* Stamping may have replaced the file, so the cache needs fresh metadata */
+	struct stat stamped;
+	if (result == 0 && found && cache && stat(filename, &stamped) == 0) {
+		cacheRecord(cache, filename, &stamped);
+	}
+
+	return result;
+}
+
+/* One span per file in the trace, whichever way the file was handled */
+int commentPath(COMMENT_CONTEXT *context, const char *filename, int discovered, VIEW *view, const struct stat *st) {
+	traceBegin("file", filename);
+	int result = commentFile(context, filename, discovered, view, st);
+	traceEnd();
+
+	countResult(context, result);
+	return result;
+}
+
+/* Returns 0 when the file was stamped or already current, 1 when it could
+ * not be stamped (or is stale, in check mode) and 2 on hard errors */
+int comment_file(COMMENT_CONTEXT *context, const char *path) {
+	return commentPath(context, path, 0, NULL, NULL);
+}
+
+/* Stamps text that is already in memory, as if it had just been saved to a
+ * file with the given name. The language (c, sh, makefile or tex) is taken
+ * from the name when not given. Nothing is read from or written to disk.
+ *
+ * The output always ends up with the whole text: stamped, or just as it came
+ * in if it already had the current date, or could not be stamped. The return
+ * codes are the same as for comment_file(). */
+int comment_buffer(COMMENT_CONTEXT *context, const char *lang, const char *name,
+		const char *in, size_t length, COMMENT_BUFFER *out) {
+	if (!name) name = "stdin";
+	traceBegin("buffer", name);
+
+	out->length = 0;
+	COMMENT data;
+	prepareData(context, &data, name, 0);
+	data.output = out;
+
+	memset(&data.stat, 0, sizeof(data.stat));
+	data.stat.st_size = length;
+	data.stat.st_mtime = time(NULL);
+	viewFromMemory(&data.view, in, length);
+
+	int result = formatDate(context, data.stat.st_mtime, &data.datetext);
+	if (result == 0) {
+		traceBegin("dispatch", NULL);
+		result = lang ? commentAs(&data, lang) : analyzeAndComment(&data);
+		traceEnd();
+	}
+	if (data.skipped) countSkipped(context);
+	if (data.stale) {
+		countStale(context, name);
+		result = 1;
+	}
+
+	if (out->length == 0) {
+		struct iovec none;
+		if (bufferPartsAndRest(out, &none, 0, &data.view, 0) != 0) {
+			fprintf(stderr, "Out of memory while copying '%s'\n", name);
+			result = 2;
+		}
+	}
+
+	traceEnd();
+	countResult(context, result);
+	return result;
+}
+
+void comment_counters(COMMENT_CONTEXT *context, COMMENT_COUNTERS *counters) {
+	pthread_mutex_lock(&context->lock);
+	*counters = context->counters;
+	pthread_mutex_unlock(&context->lock);
+}
+
+/* Writes the cache records so far, for a context that is kept around for
+ * long, and returns -1 if that failed */
+int comment_flush(COMMENT_CONTEXT *context) {
+	return cacheFlush(context->cache);
+}
+
+/* Writes the cache back, if there is one, and returns -1 if that failed */
+int comment_destroy(COMMENT_CONTEXT *context) {
+	if (!context) return 0;
+
+	int result = cacheClose(context->cache);
+	datesDestroy(context->dates);
+	pthread_mutex_destroy(&context->lock);
+	free(context);
+	return result;
+}
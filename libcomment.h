@@ -0,0 +1,74 @@
+/**
+ * @file libcomment.h
+ * @author Anders Tornblad
+ * @date 2026-10-18
+ */
+#ifndef LIBCOMMENT_H
+#define LIBCOMMENT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Only what is marked like this is exported from libcomment.so */
+#define COMMENT_API __attribute__((visibility("default")))
+
+struct comment_config {
+	char author[256];
+	int authorIsGlobal;
+	int authorIsDefault;
+
+	char dateformat[256];
+	int dateformatIsGlobal;
+	int dateformatIsDefault;
+
+	off_t headerwindow;
+	int headerwindowIsGlobal;
+	int headerwindowIsDefault;
+
+	int cacheEnabled;
+	int cacheIsGlobal;
+	int cacheIsDefault;
+
+	int uringEnabled;
+	int uringIsGlobal;
+	int uringIsDefault;
+};
+
+struct comment_counters {
+	unsigned long files;
+	unsigned long skipped;
+	unsigned long stale;
+	int result;
+};
+
+/* Memory that comment_buffer() writes into, grown with realloc() as needed.
+ * Start it out zeroed, and free() the data when done. */
+struct comment_buffer {
+	char *data;
+	size_t length;
+	size_t capacity;
+};
+
+typedef struct comment_config COMMENT_CONFIG;
+typedef struct comment_counters COMMENT_COUNTERS;
+typedef struct comment_buffer COMMENT_BUFFER;
+typedef struct comment_context COMMENT_CONTEXT;
+
+typedef void (*COMMENT_STALE)(const char *path, void *user);
+
+COMMENT_API void comment_config_defaults(COMMENT_CONFIG *config);
+COMMENT_API void comment_config_read(COMMENT_CONFIG *config, const char *filename, int global);
+COMMENT_API void comment_config_load(COMMENT_CONFIG *config, int globalOnly);
+COMMENT_API int comment_config_filename(int global, char *filename, size_t size);
+
+COMMENT_API COMMENT_CONTEXT *comment_create(const COMMENT_CONFIG *config);
+COMMENT_API void comment_set_check(COMMENT_CONTEXT *context, COMMENT_STALE stale, void *user);
+COMMENT_API int comment_open_cache(COMMENT_CONTEXT *context, const char *filename);
+COMMENT_API int comment_file(COMMENT_CONTEXT *context, const char *path);
+COMMENT_API int comment_buffer(COMMENT_CONTEXT *context, const char *lang, const char *name,
+	const char *in, size_t length, COMMENT_BUFFER *out);
+COMMENT_API void comment_counters(COMMENT_CONTEXT *context, COMMENT_COUNTERS *counters);
+COMMENT_API int comment_flush(COMMENT_CONTEXT *context);
+COMMENT_API int comment_destroy(COMMENT_CONTEXT *context);
+
+#endif